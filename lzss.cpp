@@ -0,0 +1,710 @@
+#include "lzss.hpp"
+#include "mapped_file.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+static u8 HIGH_BITS(u8 byteValue, int numBits) {
+	u32 mask = ((1 << numBits) - 1) << (8 - numBits);
+	return (byteValue & mask) >> (8 - numBits);
+}
+
+static u8 LOW_BITS(u8 byteValue, int numBits) {
+	u32 mask = ((1 << numBits) - 1);
+	return byteValue & mask;
+}
+
+static int decompress_reference(const u8 *input, size_t inputSize, u8 *output, size_t outputSize) {
+	static const u32 kDictionarySize = 4096;
+	u8 dictionary[kDictionarySize] = {};
+	u32 dictionaryOffset = 1;
+	u32 outputOffset = 0;
+
+	// The decoder looks up to two bytes ahead of the current one, which may be
+	// past the end of the input (or of the mapping), so reads are clamped.
+	auto data = [input, inputSize](size_t i) -> u8 {
+		return i < inputSize ? input[i] : 0;
+	};
+	u32 offset = 0;
+
+	u32 bitShift = 0;
+	u32 bytesWritten = 0;
+
+	while (offset < inputSize) {
+		u8 value = data(offset);
+		u8 bitMask = 0x80 >> bitShift++;
+		// First bit:
+		// 0 -> Copy data from dictionary
+		// 1 -> Copy raw byte from input
+		bool useRawByte = value & bitMask;
+		if (bitShift == 8) {
+			bitShift = 0;
+			offset++;
+		}
+		if (!useRawByte) {
+			u32 bitsFromFirst = 8 - bitShift;
+			u32 bitsFromLast = 16 - 8 - bitsFromFirst;
+
+			// The dictionary lookup is 16 bit:
+			// 12 bits for the offset
+			// 4 bits for the run-length
+
+			// Combined with the first bit this makes for 17 bits,
+			// So we will be reading from three bytes, except when
+			// the first bit was read from the end of a byte, then
+			// bitShift will be 0, and bitsFromLast will be 8.
+
+			u32 byte1 = LOW_BITS(data(offset), bitsFromFirst);
+			u32 byte2 = data(offset + 1);
+			u32 byte3 = HIGH_BITS(data(offset + 2), bitsFromLast);
+
+			u32 lookup = (byte1 << (8 + bitsFromLast)) | (byte2 << bitsFromLast) | byte3;
+
+			u32 lookupOffset = (lookup >> 4) & 0xFFF;
+			if (lookupOffset == 0) {
+				break;
+			}
+			u32 lookupRunLength = (lookup & 0xF) + 2;
+			if (lookupRunLength > outputSize - outputOffset) {
+				break;
+			}
+			for (u32 j = 0; j < lookupRunLength; j++) {
+				output[outputOffset++] = dictionary[(lookupOffset + j) % kDictionarySize];
+				dictionary[dictionaryOffset++] = dictionary[(lookupOffset + j) % kDictionarySize];
+				dictionaryOffset %= kDictionarySize;
+			}
+
+			offset += 2;
+			bytesWritten += lookupRunLength;
+		} else {
+			// Raw byte, but since we spent a bit first,
+			// we must reassemble it from potentially two bytes.
+			u32 bitsFromFirst = 8 - bitShift;
+			u32 bitsFromLast = 8 - bitsFromFirst;
+
+			u8 byteValue = LOW_BITS(data(offset), bitsFromFirst) << bitsFromLast;
+			byteValue |= HIGH_BITS(data(offset + 1), bitsFromLast);
+
+			offset++;
+
+			if (outputOffset == outputSize) {
+				break;
+			}
+			output[outputOffset++] = byteValue;
+			dictionary[dictionaryOffset++] = byteValue;
+			dictionaryOffset %= kDictionarySize;
+
+			bytesWritten++;
+		}
+
+	}
+
+	return bytesWritten;
+}
+
+void LzssStream::init(const u8 *input_, size_t inputSize_)
+{
+	input = input_;
+	inputSize = inputSize_;
+	offset = 0;
+	bits = 0;
+	count = 0;
+	memset(dictionary, 0, sizeof(dictionary));
+	dictionaryOffset = 1;
+	outputOffset = 0;
+	finished = false;
+	stats = nullptr;
+}
+
+// Tops up the bit buffer to at least 56 bits. Past the end of the input
+// everything reads as zero, which decodes as the terminating reference.
+// Returns false once the input is long exhausted.
+static inline bool refill(const u8 *input, size_t inputSize, size_t &offset, u64 &bits, u32 &count) {
+	if (offset + 8 <= inputSize) {
+		u64 next = 0;
+		for (u32 i = 0; i < 8; ++i) {
+			next = (next << 8) | input[offset + i];
+		}
+		bits |= next >> count;
+		offset += (63 - count) >> 3;
+		count |= 56;
+		return true;
+	}
+
+	if (offset >= inputSize + 8) {
+		return false;
+	}
+	while (count <= 56) {
+		u64 next = offset < inputSize ? input[offset] : 0;
+		bits |= next << (56 - count);
+		offset++;
+		count += 8;
+	}
+	return true;
+}
+
+size_t LzssStream::decode(u8 *output, size_t outputSize, size_t target)
+{
+	static const u32 kDictionaryMask = kLzssDictionarySize - 1;
+
+	// Work on locals so the state stays in registers, and store it back
+	// when stopping so that the next call continues from here.
+	u64 bits = this->bits;
+	u32 count = this->count;
+	size_t offset = this->offset;
+	u32 dictionaryOffset = this->dictionaryOffset;
+	size_t outputOffset = this->outputOffset;
+
+	if (target > outputSize) {
+		target = outputSize;
+	}
+
+	// Bits are consumed from the top of the buffer. A literal takes 9 bits,
+	// a dictionary reference 17, so one refill covers either.
+	while (!finished && outputOffset < target) {
+		if (count < 17 && !refill(input, inputSize, offset, bits, count)) {
+			finished = true;
+			break;
+		}
+
+		if (bits >> 63) {
+			if (outputOffset == outputSize) {
+				finished = true;
+				break;
+			}
+			u8 byteValue = (u8)(bits >> 55);
+			bits <<= 9;
+			count -= 9;
+
+			output[outputOffset++] = byteValue;
+			dictionary[dictionaryOffset] = byteValue;
+			dictionaryOffset = (dictionaryOffset + 1) & kDictionaryMask;
+
+			if (stats) {
+				stats->literals++;
+			}
+		} else {
+			u32 lookup = (u32)(bits >> 47) & 0xFFFF;
+			bits <<= 17;
+			count -= 17;
+
+			u32 lookupOffset = lookup >> 4;
+			if (lookupOffset == 0) {
+				finished = true;
+				break;
+			}
+			u32 lookupRunLength = (lookup & 0xF) + 2;
+			if (lookupRunLength > outputSize - outputOffset) {
+				finished = true;
+				break;
+			}
+			if (stats) {
+				stats->count_match(lookupRunLength, ((dictionaryOffset - 1 - lookupOffset) & kDictionaryMask) + 1);
+			}
+			for (u32 j = 0; j < lookupRunLength; j++) {
+				u8 byteValue = dictionary[(lookupOffset + j) & kDictionaryMask];
+				output[outputOffset++] = byteValue;
+				dictionary[dictionaryOffset] = byteValue;
+				dictionaryOffset = (dictionaryOffset + 1) & kDictionaryMask;
+			}
+		}
+	}
+
+	this->bits = bits;
+	this->count = count;
+	this->offset = offset;
+	this->dictionaryOffset = dictionaryOffset;
+	this->outputOffset = outputOffset;
+
+	return outputOffset;
+}
+
+u64 LzssStream::input_bit() const
+{
+	return (u64)offset * 8 - count;
+}
+
+void LzssStream::seek(u64 inputBit)
+{
+	offset = inputBit >> 3;
+	u32 skipBits = inputBit & 7;
+	bits = 0;
+	count = 0;
+	finished = false;
+	if (offset < inputSize) {
+		bits = (u64)input[offset] << (56 + skipBits);
+		count = 8 - skipBits;
+		offset++;
+	}
+}
+
+static int decompress_bitbuffer(const u8 *input, size_t inputSize, u8 *output, size_t outputSize, LzssStats *stats) {
+	LzssStream stream;
+	stream.init(input, inputSize);
+	stream.stats = stats;
+	return stream.decode(output, outputSize, outputSize);
+}
+
+// Full-file decode without a separate dictionary. The dictionary slot a
+// reference names always holds the byte written `distance` positions back,
+// so matches are copied straight out of the output already written.
+// Positions before the start of the output are the zero-filled initial dictionary.
+static int decompress_window(const u8 *input, size_t inputSize, u8 *output, size_t outputSize, LzssStats *stats) {
+	static const u32 kDictionaryMask = kLzssDictionarySize - 1;
+
+	u64 bits = 0;
+	u32 count = 0;
+	size_t offset = 0;
+	size_t outputOffset = 0;
+
+	while (true) {
+		if (count < 17 && !refill(input, inputSize, offset, bits, count)) {
+			break;
+		}
+
+		if (bits >> 63) {
+			if (outputOffset == outputSize) {
+				break;
+			}
+			output[outputOffset++] = (u8)(bits >> 55);
+			bits <<= 9;
+			count -= 9;
+
+			if (stats) {
+				stats->literals++;
+			}
+		} else {
+			u32 lookup = (u32)(bits >> 47) & 0xFFFF;
+			bits <<= 17;
+			count -= 17;
+
+			u32 lookupOffset = lookup >> 4;
+			if (lookupOffset == 0) {
+				break;
+			}
+			u32 lookupRunLength = (lookup & 0xF) + 2;
+			if (lookupRunLength > outputSize - outputOffset) {
+				break;
+			}
+
+			// Output position n lives in slot (n + 1) % 4096.
+			size_t distance = ((outputOffset - lookupOffset) & kDictionaryMask) + 1;
+			if (stats) {
+				stats->count_match(lookupRunLength, distance);
+			}
+			u8 *dst = output + outputOffset;
+			if (distance <= outputOffset) {
+				const u8 *src = dst - distance;
+				if (distance >= lookupRunLength) {
+					memcpy(dst, src, lookupRunLength);
+				} else {
+					for (u32 j = 0; j < lookupRunLength; j++) {
+						dst[j] = src[j];
+					}
+				}
+			} else {
+				for (u32 j = 0; j < lookupRunLength; j++) {
+					size_t pos = outputOffset + j;
+					dst[j] = pos >= distance ? output[pos - distance] : 0;
+				}
+			}
+			outputOffset += lookupRunLength;
+		}
+	}
+
+	return outputOffset;
+}
+
+void LzssStats::add(const LzssStats &other) {
+	inputBytes += other.inputBytes;
+	outputBytes += other.outputBytes;
+	seconds += other.seconds;
+	readSeconds += other.readSeconds;
+	literals += other.literals;
+	matches += other.matches;
+	for (u32 i = 0; i < 16; ++i) {
+		lengths[i] += other.lengths[i];
+	}
+	for (u32 i = 0; i < 13; ++i) {
+		distances[i] += other.distances[i];
+	}
+}
+
+int decompressLZSS(const u8 *input, size_t inputSize, u8 *output, size_t outputSize, LzssDecoder decoder, LzssStats *stats) {
+	auto start = chrono::steady_clock::now();
+
+	int written;
+	switch (decoder) {
+	case LzssDecoder::Reference:
+		written = decompress_reference(input, inputSize, output, outputSize);
+		break;
+	case LzssDecoder::Window:
+		written = decompress_window(input, inputSize, output, outputSize, stats);
+		break;
+	case LzssDecoder::Bitbuffer:
+	default:
+		written = decompress_bitbuffer(input, inputSize, output, outputSize, stats);
+		break;
+	}
+
+	if (stats) {
+		stats->inputBytes += inputSize;
+		stats->outputBytes += written;
+		stats->seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	return written;
+}
+
+int decompressLZSS(const string &filename, u8 *output, size_t outputSize, LzssDecoder decoder, LzssStats *stats) {
+	MappedFile input;
+	if (!input.open(string { "data/" } + filename)) {
+		return 0;
+	}
+
+	return decompressLZSS(input.data, input.size, output, outputSize, decoder, stats);
+}
+
+void LzssIndex::build(const u8 *input, size_t inputSize_, u32 outputSize_, u32 interval_) {
+	interval = interval_;
+	outputSize = outputSize_;
+	inputSize = inputSize_;
+	sourceTime = 0;
+	checkpoints.clear();
+
+	LzssStream stream;
+	stream.init(input, inputSize_);
+
+	// Output is decoded into a scratch buffer and dropped, the stream does not
+	// care where its output lands. A match can run 17 bytes past the target.
+	vector<u8> scratch(interval + 32);
+	u32 produced = 0;
+	while (!stream.finished && produced < outputSize) {
+		LzssCheckpoint &checkpoint = checkpoints.emplace_back();
+		checkpoint.inputBit = stream.input_bit();
+		checkpoint.outputOffset = produced;
+		checkpoint.dictionaryOffset = stream.dictionaryOffset;
+		memcpy(checkpoint.dictionary, stream.dictionary, sizeof(stream.dictionary));
+
+		stream.outputOffset = 0;
+		size_t limit = min<size_t>(scratch.size(), outputSize - produced);
+		produced += stream.decode(scratch.data(), limit, interval);
+	}
+}
+
+static const u32 kLzssIndexMagic = 0x32495A4C; // "LZI2"
+
+bool LzssIndex::load(const string &path, size_t expectedInputSize, u32 expectedOutputSize, i64 expectedSourceTime) {
+	ifstream file { path, ios::binary };
+	if (!file.is_open()) {
+		return false;
+	}
+
+	u32 header[3];
+	u32 count;
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&inputSize, sizeof(inputSize));
+	file.read((char*)&sourceTime, sizeof(sourceTime));
+	file.read((char*)&count, sizeof(count));
+	u32 magic = header[0];
+	interval = header[1];
+	outputSize = header[2];
+	if (!file || magic != kLzssIndexMagic || interval == 0
+		|| inputSize != expectedInputSize || outputSize != expectedOutputSize || sourceTime != expectedSourceTime
+		|| count > outputSize / interval + 1) {
+		return false;
+	}
+
+	checkpoints.resize(count);
+	file.read((char*)checkpoints.data(), count * sizeof(LzssCheckpoint));
+	if (!file) {
+		checkpoints.clear();
+		return false;
+	}
+	return true;
+}
+
+bool LzssIndex::save(const string &path) const {
+	ofstream file { path, ios::binary };
+	if (!file.is_open()) {
+		return false;
+	}
+
+	u32 header[3] = { kLzssIndexMagic, interval, outputSize };
+	u32 count = checkpoints.size();
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&inputSize, sizeof(inputSize));
+	file.write((const char*)&sourceTime, sizeof(sourceTime));
+	file.write((const char*)&count, sizeof(count));
+	file.write((const char*)checkpoints.data(), count * sizeof(LzssCheckpoint));
+	return (bool)file;
+}
+
+size_t LzssIndex::decode_range(const u8 *input, size_t inputSize_, u32 start, u32 len, u8 *dst) const {
+	if (checkpoints.empty() || start >= outputSize) {
+		return 0;
+	}
+	len = min(len, outputSize - start);
+
+	// Last checkpoint at or before start.
+	auto it = upper_bound(checkpoints.begin(), checkpoints.end(), start,
+		[](u32 value, const LzssCheckpoint &checkpoint) { return value < checkpoint.outputOffset; });
+	const LzssCheckpoint &checkpoint = *(it - 1);
+
+	LzssStream stream;
+	stream.input = input;
+	stream.inputSize = inputSize_;
+	stream.seek(checkpoint.inputBit);
+	stream.dictionaryOffset = checkpoint.dictionaryOffset;
+	memcpy(stream.dictionary, checkpoint.dictionary, sizeof(stream.dictionary));
+	stream.outputOffset = 0;
+
+	// Leave room for a match running past the end of the range.
+	u32 skipBytes = start - checkpoint.outputOffset;
+	vector<u8> scratch(skipBytes + len + 17);
+	size_t decoded = stream.decode(scratch.data(), scratch.size(), skipBytes + len);
+	if (decoded <= skipBytes) {
+		return 0;
+	}
+	decoded = min<size_t>(decoded - skipBytes, len);
+	memcpy(dst, scratch.data() + skipBytes, decoded);
+	return decoded;
+}
+
+// Encoder. Emits the bitstream the decoders above read: a 1 flag and an
+// 8-bit literal, or a 0 flag, a 12-bit dictionary slot and a 4-bit
+// length - 2. Slot 0 never holds data (output starts at slot 1), so a zero
+// slot terminates the stream.
+
+static const u32 kMinMatch = 2;
+static const u32 kMaxMatch = 17;
+
+struct BitWriter
+{
+	vector<u8> bytes;
+	u64 acc = 0;
+	u32 count = 0;	///< pending bits in acc, always less than 8 between calls
+
+	void put(u32 value, u32 numBits) {
+		acc = (acc << numBits) | value;
+		count += numBits;
+		while (count >= 8) {
+			count -= 8;
+			bytes.push_back((u8)(acc >> count));
+		}
+		acc &= (1u << count) - 1;
+	}
+
+	void append(const BitWriter &other) {
+		for (u8 b : other.bytes) {
+			put(b, 8);
+		}
+		put((u32)other.acc, other.count);
+	}
+};
+
+// Encodes input[begin, end). Bytes in the 4 KB before begin are already in
+// the decoder's dictionary at that point, so matches may reach back into
+// them; this is what lets blocks be encoded independently.
+static void encode_block(const u8 *input, size_t begin, size_t end, u32 effort, BitWriter &out) {
+	static const u32 kNoPosition = 0xFFFFFFFF;
+
+	u32 maxChain = 1u << (min(max(effort, 1u), 9u) - 1);
+	bool lazy = effort >= 6;
+
+	size_t historyStart = begin > kLzssDictionarySize ? begin - kLzssDictionarySize : 0;
+	vector<u32> head(65536, kNoPosition);
+	vector<u32> prev(end - historyStart, kNoPosition);
+
+	auto key = [input](size_t pos) -> u32 {
+		return input[pos] | (input[pos + 1] << 8);
+	};
+	// Chains hold every position before nextInsert, newest first.
+	size_t nextInsert = historyStart;
+	auto insert_until = [&](size_t limit) {
+		for (; nextInsert < limit; ++nextInsert) {
+			if (nextInsert + 1 < end) {
+				u32 k = key(nextInsert);
+				prev[nextInsert - historyStart] = head[k];
+				head[k] = nextInsert;
+			}
+		}
+	};
+	auto find_match = [&](size_t pos, size_t &matchPos) -> u32 {
+		u32 best = 0;
+		if (pos + kMinMatch > end) {
+			return 0;
+		}
+		u32 limit = min<size_t>(kMaxMatch, end - pos);
+		u32 chain = maxChain;
+		for (u32 q = head[key(pos)]; q != kNoPosition && chain-- != 0; q = prev[q - historyStart]) {
+			if (pos - q > kLzssDictionarySize) {
+				break;
+			}
+			if (((q + 1) & (kLzssDictionarySize - 1)) == 0) {
+				continue;
+			}
+			u32 len = 0;
+			while (len < limit && input[q + len] == input[pos + len]) {
+				len++;
+			}
+			if (len > best) {
+				best = len;
+				matchPos = q;
+				if (len == limit) {
+					break;
+				}
+			}
+		}
+		return best;
+	};
+
+	size_t pos = begin;
+	while (pos < end) {
+		insert_until(pos);
+		size_t matchPos = 0;
+		u32 len = find_match(pos, matchPos);
+
+		// Lazy matching: emit a literal instead if the next byte starts a longer match.
+		if (lazy && len >= kMinMatch && len < kMaxMatch && pos + 1 < end) {
+			insert_until(pos + 1);
+			size_t nextPos = 0;
+			u32 nextLen = find_match(pos + 1, nextPos);
+			if (nextLen > len) {
+				out.put(0x100 | input[pos], 9);
+				pos++;
+				matchPos = nextPos;
+				len = nextLen;
+			}
+		}
+
+		if (len >= kMinMatch) {
+			u32 slot = (matchPos + 1) & (kLzssDictionarySize - 1);
+			out.put((slot << 4) | (len - kMinMatch), 17);
+		} else {
+			out.put(0x100 | input[pos], 9);
+			len = 1;
+		}
+		pos += len;
+	}
+}
+
+vector<u8> compressLZSS(const u8 *input, size_t size, u32 effort, u32 threads) {
+	static const size_t kBlockSize = 256 * 1024;
+
+	size_t numBlocks = max<size_t>(1, (size + kBlockSize - 1) / kBlockSize);
+	vector<BitWriter> blocks(numBlocks);
+	auto encode = [&](size_t first, size_t step) {
+		for (size_t b = first; b < numBlocks; b += step) {
+			encode_block(input, b * kBlockSize, min(size, (b + 1) * kBlockSize), effort, blocks[b]);
+		}
+	};
+
+	threads = min<size_t>(max(threads, 1u), numBlocks);
+	if (threads == 1) {
+		encode(0, 1);
+	} else {
+		vector<thread> workers;
+		for (u32 t = 0; t < threads; ++t) {
+			workers.emplace_back(encode, t, threads);
+		}
+		for (auto &worker : workers) {
+			worker.join();
+		}
+	}
+
+	BitWriter out = std::move(blocks[0]);
+	for (size_t b = 1; b < numBlocks; ++b) {
+		out.append(blocks[b]);
+	}
+	out.put(0, 17);
+	if (out.count != 0) {
+		out.put(0, 8 - out.count);
+	}
+	return std::move(out.bytes);
+}
+
+// Differential test: random bitstreams are valid input (they decode until a
+// zero offset turns up), so every decoder must agree on them byte for byte.
+bool test_lzss_decoders(u32 iterations, u32 seed) {
+	static const LzssDecoder decoders[] = { LzssDecoder::Reference, LzssDecoder::Bitbuffer, LzssDecoder::Window };
+	static const size_t kNumDecoders = sizeof(decoders) / sizeof(decoders[0]);
+
+	mt19937 rng { seed };
+	u32 failures = 0;
+	for (u32 i = 0; i < iterations; ++i) {
+		vector<u8> input(rng() % 32768);
+		for (auto &b : input) {
+			b = (u8)rng();
+		}
+		size_t outputSize = rng() % 65536;
+
+		vector<u8> outputs[kNumDecoders];
+		int written[kNumDecoders];
+		for (size_t d = 0; d < kNumDecoders; ++d) {
+			outputs[d].assign(outputSize, 0xCD);
+			written[d] = decompressLZSS(input.data(), input.size(), outputs[d].data(), outputSize, decoders[d]);
+		}
+		for (size_t d = 1; d < kNumDecoders; ++d) {
+			if (written[d] != written[0] || outputs[d] != outputs[0]) {
+				printf("lzss: decoder %zu differs from reference, iteration %u (input %zu, output %zu, written %d vs %d)\n",
+					d, i, input.size(), outputSize, written[d], written[0]);
+				failures++;
+			}
+		}
+	}
+	printf("lzss: %u iterations, %u failures\n", iterations, failures);
+	return failures == 0;
+}
+
+bool test_lzss_encoder(u32 iterations, u32 seed) {
+	mt19937 rng { seed };
+	u32 failures = 0;
+	size_t totalInput = 0;
+	size_t totalOutput = 0;
+	for (u32 i = 0; i < iterations; ++i) {
+		// Runs, repeated phrases and noise, sometimes long enough to span blocks.
+		vector<u8> input(i % 8 == 0 ? rng() % (1024 * 1024) : rng() % 20000);
+		for (size_t pos = 0; pos < input.size();) {
+			size_t len = min<size_t>(1 + rng() % 40, input.size() - pos);
+			switch (rng() % 3) {
+			case 0:
+				memset(input.data() + pos, (u8)rng(), len);
+				break;
+			case 1:
+				for (size_t j = 0; j < len; ++j) {
+					input[pos + j] = (u8)rng();
+				}
+				break;
+			default:
+				if (pos > 0) {
+					size_t from = pos - 1 - rng() % min<size_t>(pos, 5000);
+					for (size_t j = 0; j < len; ++j) {
+						input[pos + j] = input[from + j];
+					}
+				}
+				break;
+			}
+			pos += len;
+		}
+
+		u32 effort = 1 + i % 9;
+		u32 threads = 1 + i % 4;
+		vector<u8> compressed = compressLZSS(input.data(), input.size(), effort, threads);
+		vector<u8> output(input.size());
+		int written = decompressLZSS(compressed.data(), compressed.size(), output.data(), output.size(), LzssDecoder::Reference);
+		if (written != (int)input.size() || output != input) {
+			printf("lzss: round trip failed, iteration %u (size %zu, effort %u, threads %u)\n", i, input.size(), effort, threads);
+			failures++;
+		}
+		totalInput += input.size();
+		totalOutput += compressed.size();
+	}
+	printf("lzss: %u round trips, %u failures, ratio %.3f\n", iterations, failures, totalInput ? (double)totalOutput / totalInput : 0.0);
+	return failures == 0;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "base.hpp"
+
+using namespace std;
+
+enum class LzssDecoder
+{
+	Reference,	///< original bit-at-a-time decoder
+	Bitbuffer,	///< 64-bit refillable bit buffer
+	Window,		///< bit buffer, matches copied from the output instead of a dictionary
+};
+
+static const u32 kLzssDictionarySize = 4096;
+
+// What a decode did, for finding where decoding time goes. Symbol counts
+// and histograms are only filled in by the Bitbuffer and Window decoders.
+struct LzssStats
+{
+	u64 inputBytes;
+	u64 outputBytes;
+	double seconds;
+	double readSeconds;	///< reading the compressed file, background loads only
+
+	u64 literals;
+	u64 matches;
+	u64 lengths[16];	///< match length - 2
+	u64 distances[13];	///< floor(log2(distance back)), distance is 1 to 4096
+
+	void count_match(u32 length, u32 distance)
+	{
+		matches++;
+		lengths[length - 2]++;
+		u32 bucket = 0;
+		while (distance >>= 1)
+		{
+			bucket++;
+		}
+		distances[bucket]++;
+	}
+
+	void add(const LzssStats &other);
+};
+
+// Resumable decoder state. decode() stops once at least `target` bytes of
+// output exist and continues from there on the next call. The input and
+// output buffers must stay in place between calls.
+struct LzssStream
+{
+	const u8 *input;
+	size_t inputSize;
+
+	size_t offset;	///< next input byte to load into bits
+	u64 bits;		///< pending input bits, most significant first
+	u32 count;		///< number of valid bits in bits
+
+	u8 dictionary[kLzssDictionarySize];
+	u32 dictionaryOffset;
+	size_t outputOffset;
+	bool finished;
+
+	LzssStats *stats;	///< optional, symbols decoded are counted into it
+
+	void init(const u8 *input, size_t inputSize);
+	size_t decode(u8 *output, size_t outputSize, size_t target);
+
+	u64 input_bit() const;
+	void seek(u64 inputBit);
+};
+
+// Decoder state at a symbol boundary, enough to restart decoding there.
+struct LzssCheckpoint
+{
+	u64 inputBit;
+	u32 outputOffset;
+	u32 dictionaryOffset;
+	u8 dictionary[kLzssDictionarySize];
+};
+
+// Checkpoints taken roughly every `interval` bytes of output, so that any
+// range of a compressed file can be decoded without decoding what precedes it.
+struct LzssIndex
+{
+	u32 interval;
+	u32 outputSize;
+	u64 inputSize;
+	i64 sourceTime;		///< modification time of the compressed file, set by the caller before save
+	vector<LzssCheckpoint> checkpoints;
+
+	void build(const u8 *input, size_t inputSize, u32 outputSize, u32 interval = 64 * 1024);
+	// Only accepts an index made for a source with these sizes and time.
+	bool load(const string &path, size_t inputSize, u32 outputSize, i64 sourceTime);
+	bool save(const string &path) const;
+
+	// Decodes output bytes [start, start + len) into dst, returns how many were decoded.
+	size_t decode_range(const u8 *input, size_t inputSize, u32 start, u32 len, u8 *dst) const;
+};
+
+// All decoders produce identical output and return the number of bytes
+// written, which never exceeds outputSize. If stats is given the decode is
+// timed and counted into it.
+int decompressLZSS(const u8 *input, size_t inputSize, u8 *output, size_t outputSize, LzssDecoder decoder = LzssDecoder::Window, LzssStats *stats = nullptr);
+int decompressLZSS(const string &filename, u8 *output, size_t outputSize, LzssDecoder decoder = LzssDecoder::Window, LzssStats *stats = nullptr);
+
+// Produces a stream the decoders above accept. effort (1-9) sets how far
+// match candidates are searched, from 6 on with lazy matching. Inputs over
+// 256 KB are split into blocks that can be encoded on separate threads.
+vector<u8> compressLZSS(const u8 *input, size_t size, u32 effort = 6, u32 threads = 1);
+
+// Runs all decoders on random input and reports any difference in output.
+bool test_lzss_decoders(u32 iterations, u32 seed);
+// Round-trips compressible random data through the encoder and the reference decoder.
+bool test_lzss_encoder(u32 iterations, u32 seed);
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "base.hpp"
+
+using namespace std;
+
+// Read-only view of a whole file. Uses mmap where available and falls back
+// to reading the file into a heap buffer otherwise (or if mapping fails).
+struct MappedFile
+{
+	const u8 *data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	vector<u8> buffer;
+
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile &&other)
+	{
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile &&other)
+	{
+		if (this != &other)
+		{
+			close();
+			data = other.data;
+			size = other.size;
+			mapped = other.mapped;
+			buffer = std::move(other.buffer);
+			other.data = nullptr;
+			other.size = 0;
+			other.mapped = false;
+		}
+		return *this;
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	bool is_open() const
+	{
+		return data != nullptr;
+	}
+
+	bool open(const string &path, bool sequential = true)
+	{
+		close();
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		open_fd(fd, sequential);
+		::close(fd);
+		if (mapped)
+		{
+			return true;
+		}
+#endif
+		return read(path);
+	}
+
+#ifndef _WIN32
+	// Maps an already open descriptor, which the caller still closes.
+	bool open_fd(int fd, bool sequential = true)
+	{
+		close();
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				madvise(p, st.st_size, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+				data = (const u8*)p;
+				size = st.st_size;
+				mapped = true;
+			}
+		}
+		return mapped;
+	}
+#endif
+
+	// Reads the whole file into the heap buffer with pread, so the pages
+	// are resident before anyone touches them. Used by the read-ahead
+	// stage, where a fault inside the decoder would stall a worker on I/O.
+	bool load(const string &path)
+	{
+		close();
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			::close(fd);
+			return false;
+		}
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(fd, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+#endif
+		buffer.resize(st.st_size);
+		size_t done = 0;
+		while (done < buffer.size())
+		{
+			ssize_t n = pread(fd, buffer.data() + done, buffer.size() - done, done);
+			if (n <= 0)
+			{
+				break;
+			}
+			done += n;
+		}
+		::close(fd);
+		if (done != buffer.size())
+		{
+			buffer.clear();
+			return false;
+		}
+		data = buffer.data();
+		size = buffer.size();
+		return true;
+#else
+		return read(path);
+#endif
+	}
+
+	void close()
+	{
+#ifndef _WIN32
+		if (mapped)
+		{
+			munmap((void*)data, size);
+		}
+#endif
+		buffer.clear();
+		buffer.shrink_to_fit();
+		data = nullptr;
+		size = 0;
+		mapped = false;
+	}
+
+private:
+	bool read(const string &path)
+	{
+		ifstream input { path, ios::binary | ios::ate };
+		if (!input.is_open())
+		{
+			return false;
+		}
+		buffer.resize(input.tellg());
+		input.seekg(0);
+		input.read((char*)buffer.data(), buffer.size());
+		if (buffer.empty())
+		{
+			return false;
+		}
+		data = buffer.data();
+		size = buffer.size();
+		return true;
+	}
+};
@@ -1,51 +1,112 @@
 #pragma once
 
-#include <string>
-#include <iostream>
+#include <cstddef>
 
 #include "base.hpp"
 
 using namespace std;
 
-static void skip(istream &stream, size_t len)
+// Something that produces the bytes behind a Reader incrementally.
+struct ReaderSource
 {
-	stream.seekg(len, ios_base::cur);
+	// Makes at least the first `end` bytes available, returns how many are.
+	virtual size_t fill(size_t end) = 0;
+};
+
+// Non-owning little-endian view over a block of memory.
+// Reading past the end sets fail and returns zero, similar to an istream's failbit.
+// When a source is set only the first `available` bytes are ready yet, the
+// rest is requested from the source (at `origin` within it) when reached.
+struct Reader
+{
+	const u8 *data;
+	size_t size;
+	size_t pos;
+	bool fail;
+
+	size_t available;
+	ReaderSource *source;
+	size_t origin;
+
+	Reader()
+	: data { nullptr }, size { 0 }, pos { 0 }, fail { true }
+	, available { 0 }, source { nullptr }, origin { 0 }
+	{}
+
+	Reader(const u8 *data_, size_t size_)
+	: data { data_ }, size { size_ }, pos { 0 }, fail { false }
+	, available { size_ }, source { nullptr }, origin { 0 }
+	{}
+
+	Reader(const u8 *data_, size_t size_, size_t available_, ReaderSource *source_, size_t origin_)
+	: data { data_ }, size { size_ }, pos { 0 }, fail { false }
+	, available { available_ < size_ ? available_ : size_ }, source { source_ }, origin { origin_ }
+	{}
+};
+
+static bool reserve(Reader &reader, size_t len)
+{
+	if (reader.available - reader.pos >= len)
+	{
+		return true;
+	}
+	if (reader.source != nullptr && reader.size - reader.pos >= len)
+	{
+		size_t end = reader.source->fill(reader.origin + reader.pos + len);
+		end = end > reader.origin ? end - reader.origin : 0;
+		reader.available = end < reader.size ? end : reader.size;
+		if (reader.available - reader.pos >= len)
+		{
+			return true;
+		}
+	}
+	reader.size = reader.available;
+	reader.pos = reader.available;
+	reader.source = nullptr;
+	reader.fail = true;
+	return false;
 }
 
-static u8 read_u8(istream &stream)
+static void skip(Reader &reader, size_t len)
 {
-	u8 val;
-	stream.read((char*)&val, sizeof(u8));
-	return val;
+	if (reserve(reader, len))
+	{
+		reader.pos += len;
+	}
 }
 
-static u16 read_u16(istream &stream)
+static u8 read_u8(Reader &reader)
 {
-	u16 val;
-	stream.read((char*)&val, sizeof(u16));
-	return val;
+	if (!reserve(reader, sizeof(u8)))
+	{
+		return 0;
+	}
+	return reader.data[reader.pos++];
 }
 
-static u32 read_u32(istream &stream)
+static u16 read_u16(Reader &reader)
 {
-	u32 val;
-	stream.read((char*)&val, sizeof(u32));
-	return val;
+	if (!reserve(reader, sizeof(u16)))
+	{
+		return 0;
+	}
+	const u8 *p = reader.data + reader.pos;
+	reader.pos += sizeof(u16);
+	return (u16)(p[0] | (p[1] << 8));
 }
 
-static i32 read_i32(istream &stream)
+static u32 read_u32(Reader &reader)
 {
-	i32 val;
-	stream.read((char*)&val, sizeof(i32));
-	return val;
+	if (!reserve(reader, sizeof(u32)))
+	{
+		return 0;
+	}
+	const u8 *p = reader.data + reader.pos;
+	reader.pos += sizeof(u32);
+	return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
 }
 
-static string read_string(istream &stream, size_t len)
+static i32 read_i32(Reader &reader)
 {
-	char *buf = new char[len + 1];
-	stream.read(buf, len);
-	buf[len] = 0;
-	string val(buf);
-	delete[] buf;
-	return val;
+	return (i32)read_u32(reader);
 }
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+
+#include "base.hpp"
+#include "read.hpp"
+
+using namespace std;
+
+// Compile-time description of a fixed size record in the data files. The
+// struct holding a record starts with its handle and then mirrors the disk
+// layout field for field, so parsing is a memcpy (the data is little endian
+// like the host, as for IndexRecord). Parsers, viewer tables and exporters
+// all walk the same field list.
+
+enum class FieldType : u8
+{
+	U16,
+	U32,
+	I32
+};
+
+enum class FieldFormat : u8
+{
+	Dec,	///< shown signed, like the engine's ints
+	Hex		///< handles, ids and flags
+};
+
+struct Field
+{
+	const char *name;
+	FieldType type;
+	FieldFormat format;
+	u32 count;		///< elements, more than 1 for arrays
+	u32 offset;		///< in the record on disk
+	u32 member;		///< offsetof the struct member
+};
+
+template<typename T> constexpr FieldType field_type();
+template<> constexpr FieldType field_type<u16>() { return FieldType::U16; }
+template<> constexpr FieldType field_type<u32>() { return FieldType::U32; }
+template<> constexpr FieldType field_type<i32>() { return FieldType::I32; }
+
+constexpr u32 field_size(FieldType type)
+{
+	return type == FieldType::U16 ? 2 : 4;
+}
+
+// Specialised next to each record struct with its name, size on disk and
+// fields, see schema_valid for what is checked.
+template<typename R> struct Schema;
+
+#define SCHEMA_FIELD(R, member, offset, format) \
+	Field { #member, field_type<remove_all_extents_t<decltype(R::member)>>(), FieldFormat::format, \
+		extent_v<decltype(R::member)> == 0 ? 1 : (u32)extent_v<decltype(R::member)>, offset, offsetof(R, member) }
+
+template<typename R>
+constexpr u32 field_count()
+{
+	return sizeof(Schema<R>::fields) / sizeof(Field);
+}
+
+// Fields follow each other without gaps from offset 0 up to the record
+// size, and the struct members sit at the same distances from the first.
+template<typename R>
+constexpr bool schema_valid()
+{
+	const Field *fields = Schema<R>::fields;
+	u32 offset = 0;
+	for (u32 i = 0; i < field_count<R>(); ++i)
+	{
+		if (fields[i].offset != offset || fields[i].member != fields[0].member + offset)
+		{
+			return false;
+		}
+		offset += field_size(fields[i].type) * fields[i].count;
+	}
+	return is_standard_layout_v<R>
+		&& offset == Schema<R>::size
+		&& fields[0].member + Schema<R>::size <= sizeof(R);
+}
+
+// Copies one record, zeroing its fields if the data runs out.
+template<typename R>
+static bool read_record(Reader &reader, R &record)
+{
+	constexpr u32 size = Schema<R>::size;
+	if (!reserve(reader, size))
+	{
+		memset((u8*)&record + Schema<R>::fields[0].member, 0, size);
+		return false;
+	}
+	memcpy((u8*)&record + Schema<R>::fields[0].member, reader.data + reader.pos, size);
+	reader.pos += size;
+	return true;
+}
+
+// Appends count records read in one pass, numbering their handles on from
+// handle. Records the data does not fully cover are still added, zeroed.
+template<typename R, typename V>
+static void read_records(Reader &reader, u32 count, u32 handle, V &records)
+{
+	constexpr u32 size = Schema<R>::size;
+	size_t pos = reader.pos;
+	size_t available = reserve(reader, (size_t)count * size) ? (size_t)count * size : reader.size - pos;
+	size_t complete = available / size;
+
+	size_t first = records.size();
+	records.resize(first + count);
+	for (u32 i = 0; i < count; ++i)
+	{
+		R &record = records[first + i];
+		record.handle = handle + i * size;
+		if (i < complete)
+		{
+			memcpy((u8*)&record + Schema<R>::fields[0].member, reader.data + pos + (size_t)i * size, size);
+		}
+	}
+	reader.pos = pos + (count <= complete ? (size_t)count * size : available);
+}
+
+// Element of a field as an integer, Dec fields sign extended.
+template<typename R>
+static i64 field_value(const R &record, const Field &field, u32 element = 0)
+{
+	const u8 *p = (const u8*)&record + field.member + element * field_size(field.type);
+	if (field.type == FieldType::U16)
+	{
+		u16 value;
+		memcpy(&value, p, sizeof(value));
+		return field.format == FieldFormat::Dec ? (i64)(i16)value : (i64)value;
+	}
+	u32 value;
+	memcpy(&value, p, sizeof(value));
+	return field.format == FieldFormat::Dec ? (i64)(i32)value : (i64)value;
+}
+
+// Field as shown in the viewer, array elements separated by spaces.
+template<typename R>
+static void format_field(char *buf, size_t len, const R &record, const Field &field)
+{
+	size_t used = 0;
+	buf[0] = 0;
+	for (u32 i = 0; i < field.count && used < len; ++i)
+	{
+		i64 value = field_value(record, field, i);
+		int n = field.format == FieldFormat::Hex
+			? snprintf(buf + used, len - used, i == 0 ? "%08x" : " %08x", (u32)value)
+			: snprintf(buf + used, len - used, i == 0 ? "%d" : " %d", (i32)value);
+		used += n > 0 ? n : 0;
+	}
+}
+
+// Exports write plain decimal values, arrays as one column per element in
+// CSV and as a list in JSON.
+template<typename R>
+static void write_csv_header(ostream &output)
+{
+	output << "handle";
+	for (const Field &field : Schema<R>::fields)
+	{
+		for (u32 i = 0; i < field.count; ++i)
+		{
+			output << "," << field.name;
+			if (field.count > 1)
+			{
+				output << i;
+			}
+		}
+	}
+	output << "\n";
+}
+
+template<typename R>
+static void write_csv_row(ostream &output, const R &record)
+{
+	output << record.handle;
+	for (const Field &field : Schema<R>::fields)
+	{
+		for (u32 i = 0; i < field.count; ++i)
+		{
+			output << "," << field_value(record, field, i);
+		}
+	}
+	output << "\n";
+}
+
+template<typename R>
+static void write_json(ostream &output, const R &record)
+{
+	output << "{\"handle\":" << record.handle;
+	for (const Field &field : Schema<R>::fields)
+	{
+		output << ",\"" << field.name << "\":";
+		if (field.count > 1)
+		{
+			output << "[";
+		}
+		for (u32 i = 0; i < field.count; ++i)
+		{
+			output << (i == 0 ? "" : ",") << field_value(record, field, i);
+		}
+		if (field.count > 1)
+		{
+			output << "]";
+		}
+	}
+	output << "}";
+}
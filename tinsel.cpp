@@ -1,112 +1,20 @@
 #include "tinsel.hpp"
+#include "mapped_file.hpp"
 
 #include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
 
-using namespace std;
-
-static u8 HIGH_BITS(u8 byteValue, int numBits) {
-	u32 mask = ((1 << numBits) - 1) << (8 - numBits);
-	return (byteValue & mask) >> (8 - numBits);
-}
-
-static u8 LOW_BITS(u8 byteValue, int numBits) {
-	u32 mask = ((1 << numBits) - 1);
-	return byteValue & mask;
-}
-
-int decompressLZSS(string &filename, u8 *output) {
-	static const u32 kDictionarySize = 4096;
-	u8 dictionary[kDictionarySize] = {};
-	u32 dictionaryOffset = 1;
-	u32 outputOffset = 0;
-
-	ifstream input { string { "data/" } + filename, ios::binary | ios::ate };
-	if (!input.is_open()) {
-		return 0;
-	}
-
-	size_t inputSize = input.tellg();
-	input.seekg(0);
-
-	u8 *data = new u8[inputSize];
-	input.read((char*)data, inputSize);
-	u32 offset = 0;
-
-	u32 bitShift = 0;
-	u32 bytesWritten = 0;
-
-	while (true) {
-		u8 value = data[offset];
-		u8 bitMask = 0x80 >> bitShift++;
-		// First bit:
-		// 0 -> Copy data from dictionary
-		// 1 -> Copy raw byte from input
-		bool useRawByte = value & bitMask;
-		if (bitShift == 8) {
-			bitShift = 0;
-			offset++;
-		}
-		if (!useRawByte) {
-			u32 bitsFromFirst = 8 - bitShift;
-			u32 bitsFromLast = 16 - 8 - bitsFromFirst;
-
-			// The dictionary lookup is 16 bit:
-			// 12 bits for the offset
-			// 4 bits for the run-length
-
-			// Combined with the first bit this makes for 17 bits,
-			// So we will be reading from three bytes, except when
-			// the first bit was read from the end of a byte, then
-			// bitShift will be 0, and bitsFromLast will be 8.
-
-			// We make the assumption that we can dereference the third byte
-			// even if we aren't using it. We will check "offset" after decompression
-			// to verify this assumption.
-			u32 byte1 = LOW_BITS(data[offset], bitsFromFirst);
-			u32 byte2 = data[offset + 1];
-			u32 byte3 = HIGH_BITS(data[offset + 2], bitsFromLast);
-
-			u32 lookup = (byte1 << (8 + bitsFromLast)) | (byte2 << bitsFromLast) | byte3;
-
-			u32 lookupOffset = (lookup >> 4) & 0xFFF;
-			if (lookupOffset == 0) {
-				break;
-			}
-			u32 lookupRunLength = (lookup & 0xF) + 2;
-			for (u32 j = 0; j < lookupRunLength; j++) {
-				output[outputOffset++] = dictionary[(lookupOffset + j) % kDictionarySize];
-				dictionary[dictionaryOffset++] = dictionary[(lookupOffset + j) % kDictionarySize];
-				dictionaryOffset %= kDictionarySize;
-			}
-
-			offset += 2;
-			bytesWritten += lookupRunLength;
-		} else {
-			// Raw byte, but since we spent a bit first,
-			// we must reassemble it from potentially two bytes.
-			u32 bitsFromFirst = 8 - bitShift;
-			u32 bitsFromLast = 8 - bitsFromFirst;
-
-			u8 byteValue = LOW_BITS(data[offset], bitsFromFirst) << bitsFromLast;
-			byteValue |= HIGH_BITS(data[offset + 1], bitsFromLast);
-
-			offset++;
-
-			output[outputOffset++] = byteValue;
-			dictionary[dictionaryOffset++] = byteValue;
-			dictionaryOffset %= kDictionarySize;
-
-			bytesWritten++;
-		}
-
-	}
-	delete[] data;
+#ifndef _WIN32
+#include <sys/file.h>
+#endif
 
-	return bytesWritten;
-}
+using namespace std;
 
 static const char * AnimScriptOpCodes[] = {
 	"ANI_END", "ANI_JUMP", "ANI_HFLIP", "ANI_VFLIP", "ANI_HVFLIP", "ANI_ADJUSTX", "ANI_ADJUSTY", "ANI_ADJUSTXY", "ANI_NOSLEEP", "ANI_CALL", "ANI_HIDE", "ANI_STOP",
@@ -130,13 +38,13 @@ AnimScriptLine::AnimScriptLine(u32 ip_, u32 hFrame_)
 {
 }
 
-vector<AnimScriptLine> animscript_disassemble(istream &code)
+vector<AnimScriptLine> animscript_disassemble(Reader code)
 {
 	bool bHalt = false;
 	vector<AnimScriptLine> out;
 	do
 	{
-		u32 ip = code.tellg();
+		u32 ip = code.pos;
 		u32 opcode = read_u32(code);
 
 		switch (opcode) {
@@ -188,7 +96,7 @@ vector<AnimScriptLine> animscript_disassemble(istream &code)
 
 		}
 
-	} while (!bHalt);
+	} while (!bHalt && !code.fail);
 
 	return out;
 }
@@ -201,39 +109,87 @@ static const char * PcodeLibCodes[] = {
 	"NOFUNCTION", "ACTORBRIGHTNESS", "ACTORDIRECTION", "ACTORPRIORITY", "ACTORREF", "ACTORRGB", "ACTORXPOS", "ACTORYPOS", "ADDNOTEBOOK", "ADDCONV", "ADDHIGHLIGHT", "ADDINV8_T3", "ADDINV1", "ADDINV2", "ADDINV7_T3", "ADDINV4_T3", "ADDINV3_T3", "ADDTOPIC", "BACKGROUND", "BLOCKING", "UNKNOWN_14h", "CALLACTOR", "CALLGLOBALPROCESS", "CALLOBJECT", "CALLPROCESS", "CALLSCENE", "CALLTAG", "CAMERA", "CDCHANGESCENE", "CDDOCHANGE", "CDENDACTOR", "CDLOAD", "CDPLAY", "UNKNOWN_21h", "CLEARHOOKSCENE", "CLOSEINVENTORY", "CLOSEINVENTORY_24h", "CONTROL", "CONVERSATION", "UNKNOWN_27h", "CURSOR", "CURSORXPOS", "CURSORYPOS", "DECINVMAIN", "DECINV2", "DECLARELANGUAGE", "DECLEAD", "DEC3D", "DECTAGFONT", "DECTALKFONT", "DELTOPIC", "UNKNOWN_33h", "DIMMUSIC", "DROP", "DROPEVERYTHING", "DROPOUT", "EFFECTACTOR", "ENABLEMENU", "ENDACTOR", "ESCAPEOFF", "ESCAPEON", "EVENT", "FACETAG", "FADEIN", "FADEMUSIC_T3", "FADEOUT", "FRAMEGRAB", "FREEZECURSOR", "GETINVLIMIT", "GHOST", "GLOBALVAR", "GRABMOVIE", "HAILSCENE", "HASRESTARTED", "HAVE", "HELDOBJECT?", "HELDOBJECT2?", "HIDEACTOR", "HIDEBLOCK", "HIDEEFFECT", "HIDEPATH", "HIDEREFER", "HIDE_UNKNOWN_T3", "HIDETAG", "HOLD", "HOOKSCENE", "HYPERLINK_T3", "IDLETIME", "INSTANTSCROLL", "INVENTORY", "INVPLAY", "INWHICHINV", "KILLACTOR", "KILLGLOBALPROCESS", "KILLPROCESS", "LOCALVAR", "MOVECURSOR", "MOVETAG", "MOVETAGTO", "NEWSCENE", "NOBLOCKING", "NOPAUSE", "NOSCROLL", "UNKNOWN_67h", "OFFSET", "INVENTORY4_T3", "INVENTORY3_T3", "OTHEROBJECT", "PAUSE", "HOLD_T3?", "PLAY", "PLAYMOVIE", "PLAYMUSIC", "PLAYSAMPLE", "POINTACTOR", "POINTTAG", "POSTACTOR", "UNKNOWN75h", "POSTGLOBALPROCESS", "POSTOBJECT", "POSTPROCESS", "POSTTAG", "PREPAREMOVIE", "PRINT", "PRINTCURSOR", "PRINTOBJ", "PRINTTAG", "QUITGAME", "RANDOM", "RESETIDLETIME", "RESTARTGAME", "RESTORESCENE", "RESUMELASTGAME", "RUNMODE", "SAVESCENE", "SAY", "SAYAT", "SCREENXPOS", "SCREENYPOS", "SCOLL", "SCROLLPARAMETERS", "SENDACTOR", "SENDGLOBALPROCESS", "SENDOBJECT", "SENDPROCESS", "SENDTAG", "SETBRIGHTNESS", "SETINVLIMIT", "SETINVSIZE", "SETLANGUAGE", "UNKNOWN_96h", "SETSYSTEMREEL", "SETSYSTEMSTRING", "SETSYSTEMVAR", "SETVIEW_T3", "SHELL", "SHOWACTOR", "SHOWBLOCK", "SHOWEFFECT", "SHOWMENU", "SHOWPATH", "SHOWREFER", "SHOW_UNKNOWN", "SHOWTAG", "STAND", "STANDTAG", "STARTGLOBALPROCESS", "STARTPROCESS", "STARTTIMER", "STOPALLSAMPLES", "STOPSAMPLE", "STOPWALK", "SUBTITLES", "SWALK", "SWALKZ", "SYSTEMVAR", "TAGTAGXPOS", "TAGTAGYPOS", "TAGWALKXPOS", "TAGWALKYPOS", "TALK", "TALKAT", "TALKRGB", "TALKVIA", "TEMPTAGFONT", "TEMPTALKFONT", "THISOBJECT", "THISTAG", "TIMER", "TOPIC", "TOPPLAY", "TOPWINDOW", "UNDIMMUSIC", "UNHOOKSCENE", "WAITFRAME", "WAITKEY", "WAITSCROLL", "WAITTIME", "WALK", "WALKED", "WALKEDPOLY", "WALKEDTAG", "WALKINGACTOR", "WALKPOLY", "WALKTAG", "WALKXPOS", "WALKYPOS", "WHICHCD", "WHICHINVENTORY", "ZZZZZZ", "NTBPOLYENTRY", "PLAYSEQUENCE", "NTBPOLYPREVPAGE", "NTBPOLYNEXTPAGE", "SET3DTEXTURE_T3", "UNKNOWN_D7h", "UNKNOWN_D8h", "VOICEOVER", "TALK_DAh", "TALK_DBh", "TALK_DCh", "SAY_DDh", "SAY_DEh", "SAY_DFh", "LOAD3DOVERLAY", "PLAYMOVIEu_T3", "WAITSPRITER", "UNKNOWN_E3h", "UNKNOWN_E4h", "UNKNOWN_E5h", "UNKNOWN_E6h"
 };
 
-PcodeScriptLine::PcodeScriptLine(u32 ip_, u32 opcode_)
+PcodeScriptLine::PcodeScriptLine(u32 ip_, u32 opcode_, const allocator_type &alloc)
 : ip { ip_ }
 , opcode { opcode_ }
 , hasArgument { false }
-, opcodeStr { PcodeOpCodes[opcode_] }
-, argumentStr { "" }
+, opcodeStr { PcodeOpCodes[opcode_], alloc }
+, argumentStr { alloc }
 {}
 
-PcodeScriptLine::PcodeScriptLine(u32 ip_, u32 opcode_, u32 argument_)
+PcodeScriptLine::PcodeScriptLine(u32 ip_, u32 opcode_, u32 argument_, const allocator_type &alloc)
 : ip { ip_ }
 , opcode { opcode_ }
 , argument { argument_ }
 , hasArgument { true }
-, opcodeStr { PcodeOpCodes[opcode_] }
+, opcodeStr { PcodeOpCodes[opcode_], alloc }
+, argumentStr { alloc }
 {
 	if (opcode == OP_LIBCALL)
 	{
 		argumentStr = PcodeLibCodes[argument_];
 	} else {
-		std::ostringstream ss;
-		ss << hex << argument_ << "; = " << dec << argument_;
-		argumentStr = ss.str();
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%x; = %u", argument_, argument_);
+		argumentStr = buf;
 	}
 }
 
-PcodeScriptLine::PcodeScriptLine(u32 ip_, string text_)
+PcodeScriptLine::PcodeScriptLine(u32 ip_, string_view text_, const allocator_type &alloc)
 : ip { ip_ }
 , opcode { 0 }
 , hasArgument { false }
-, opcodeStr { text_ }
+, opcodeStr { text_, alloc }
+, argumentStr { alloc }
+{}
+
+PcodeScriptLine::PcodeScriptLine(const PcodeScriptLine &other, const allocator_type &alloc)
+: ip { other.ip }
+, opcode { other.opcode }
+, argument { other.argument }
+, hasArgument { other.hasArgument }
+, opcodeStr { other.opcodeStr, alloc }
+, argumentStr { other.argumentStr, alloc }
+{}
+
+PcodeScriptLine::PcodeScriptLine(PcodeScriptLine &&other, const allocator_type &alloc)
+: ip { other.ip }
+, opcode { other.opcode }
+, argument { other.argument }
+, hasArgument { other.hasArgument }
+, opcodeStr { std::move(other.opcodeStr), alloc }
+, argumentStr { std::move(other.argumentStr), alloc }
 {}
 
-static u32 get_bytes(istream &code, u32 numBytes)
+PcodeScript::PcodeScript(const allocator_type &alloc)
+: handle { 0 }
+, name { alloc }
+, disassembled { false }
+, disassembly { alloc }
+{}
+
+PcodeScript::PcodeScript(const PcodeScript &other, const allocator_type &alloc)
+: handle { other.handle }
+, name { other.name, alloc }
+, disassembled { other.disassembled }
+, disassembly { other.disassembly, alloc }
+{}
+
+PcodeScript::PcodeScript(PcodeScript &&other, const allocator_type &alloc)
+: handle { other.handle }
+, name { std::move(other.name), alloc }
+, disassembled { other.disassembled }
+, disassembly { std::move(other.disassembly), alloc }
+{}
+
+Scene::Scene(pmr::memory_resource *resource)
+: SceneRecord {}
+, entrances { resource }
+, polys { resource }
+, actors { resource }
+{}
+
+static u32 get_bytes(Reader &code, u32 numBytes)
 {
 	u32 tmp;
 	switch (numBytes)
@@ -255,7 +211,7 @@ static u32 get_bytes(istream &code, u32 numBytes)
 	return tmp;
 }
 
-static u32 fetch(u8 opcode, istream &code) {
+static u32 fetch(u8 opcode, Reader &code) {
 	if (opcode & 0x40)
 	{
 		return get_bytes(code, 1);
@@ -270,13 +226,13 @@ static u32 fetch(u8 opcode, istream &code) {
 	}
 }
 
-vector<PcodeScriptLine> pcode_disassemble(istream &code)
+pmr::vector<PcodeScriptLine> pcode_disassemble(Reader code, pmr::memory_resource *resource)
 {
 	bool bHalt = false;
-	vector<PcodeScriptLine> out;;
+	pmr::vector<PcodeScriptLine> out { resource };
 	do
 	{
-		u32 ip = code.tellg();
+		u32 ip = code.pos;
 		u8 opcode = (u8)get_bytes(code, 0);
 
 		switch (opcode & 0x3F) {
@@ -335,11 +291,60 @@ vector<PcodeScriptLine> pcode_disassemble(istream &code)
 			out.emplace_back(ip, "???");
 		}
 
-	} while (!bHalt);
+	} while (!bHalt && !code.fail);
 
 	return out;
 }
 
+// Walks a script the way pcode_disassemble does without building its lines,
+// calling visit(opcode, argument) for each instruction.
+template<typename F>
+static void pcode_scan(Reader code, F visit)
+{
+	bool halt = false;
+	do
+	{
+		u8 opcode = (u8)get_bytes(code, 0);
+		switch (opcode & 0x3F)
+		{
+		case OP_IMM:
+		case OP_STR:
+		case OP_FILM:
+		case OP_CDFILM:
+		case OP_FONT:
+		case OP_PAL:
+		case OP_LOAD:
+		case OP_GLOAD:
+		case OP_STORE:
+		case OP_GSTORE:
+		case OP_CALL:
+		case OP_LIBCALL:
+		case OP_ALLOC:
+		case OP_JUMP:
+		case OP_JMPFALSE:
+		case OP_JMPTRUE:
+			visit(opcode & 0x3F, fetch(opcode, code));
+			break;
+
+		default:
+			halt = (opcode & 0x3F) == OP_HALT;
+			visit(opcode & 0x3F, 0);
+		}
+	} while (!halt && !code.fail);
+}
+
+static u32 pcode_lib_code(string_view name)
+{
+	for (u32 i = 0; i < size(PcodeLibCodes); ++i)
+	{
+		if (name == PcodeLibCodes[i])
+		{
+			return i;
+		}
+	}
+	return 0xFFFFFFFF;
+}
+
 Tinsel::Tinsel(): chunkTypeNames {
 		{ ChunkType::CHUNK_STRING, "CHUNK_STRING" },
 		{ ChunkType::CHUNK_BITMAP, "CHUNK_BITMAP" },
@@ -378,333 +383,1543 @@ Tinsel::Tinsel(): chunkTypeNames {
 		{ ChunkType::CHUNK_GAME, "CHUNK_GAME" },
 		{ ChunkType::CHUNK_GRAB_NAME, "CHUNK_GRAB_NAME" },
 	}
+, stringsId { 0xFFFFFFFF }
+, collectStats { false }
+, sharedCache { false }
+, chunkCatalog { false }
+, traceAccess { false }
+, memoryBudget { 0 }
+, useClock { 0 }
+, loadsQueued { 0 }
+, loadsDone { 0 }
+, readAheadBytes { 0 }
 {
 }
 
-void Tinsel::load_index()
+// Queued loads still run while the pools shut down and use the read-ahead
+// and result members, so stop the pools before anything else goes.
+Tinsel::~Tinsel()
 {
-	ifstream input {"data/index", ios::binary | ios::ate };
-
-	size_t count = input.tellg() / 24;
-	input.seekg(0);
-
-	memHandles.reserve(count);
-
-	for(u32 i = 0; i < count; ++i)
-	{
-		MemHandle &memHandle = memHandles.emplace_back();
-		memHandle.id = i;
-		memHandle.name = read_string(input, 12);
-		memHandle.size = read_u32(input);
-		skip(input, 4);
-		memHandle.flags = read_u32(input);
+	ioWorkers.reset();
+	workers.reset();
+}
 
-		memHandle.loaded = false;
-		memHandle.data.clear();
+// Builds dir/name+suffix, names come from the index as string_views.
+static string file_path(const char *dir, string_view name, const char *suffix = "")
+{
+	string path { dir };
+	path += name;
+	path += suffix;
+	return path;
+}
 
-		if (memHandle.flags & (u32)MemHandleFlags::Preload)
-		{
-			load_memhandle(i);
+// Decompressed cache: cache/<name>.bin holds a CacheHeader followed by the
+// decompressed contents of data/<name>. An entry is only used if the source
+// file still has the recorded size and modification time and the contents
+// still hash to the recorded value.
+static const u32 kCacheMagic = 0x31435354; // "TSC1"
 
-			ofstream output { memHandle.name + ".uncompressed", ios::binary};
-			output.write((char*)memHandle.data.data(), memHandle.size);
-		}
+struct CacheHeader
+{
+	u32 magic;
+	u32 size;
+	u64 sourceSize;
+	i64 sourceTime;
+	u64 hash;
+};
+static_assert(sizeof(CacheHeader) == 32, "cache header must keep the data aligned");
 
+static u64 hash_bytes(const u8 *data, size_t size)
+{
+	u64 hash = 0xcbf29ce484222325ull ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		u64 word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i)
+	{
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
 	}
+	return hash;
 }
 
-void Tinsel::load_memhandle(u32 i)
+static bool source_stamp(string_view name, u64 &size, i64 &time)
 {
-	MemHandle &memHandle = memHandles[i];
-	if (memHandle.loaded)
+	error_code error;
+	filesystem::path path { file_path("data/", name) };
+	size = filesystem::file_size(path, error);
+	if (error)
 	{
-		return;
+		return false;
 	}
+	time = filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
 
-	memHandle.data.resize(memHandle.size);
+static bool valid_cache(const MappedFile &file, u32 size, u64 sourceSize, i64 sourceTime)
+{
+	const CacheHeader *header = (const CacheHeader*)file.data;
+	return file.size == sizeof(CacheHeader) + size
+		&& header->magic == kCacheMagic
+		&& header->size == size
+		&& header->sourceSize == sourceSize
+		&& header->sourceTime == sourceTime
+		&& header->hash == hash_bytes(file.data + sizeof(CacheHeader), size);
+}
 
-	if (decompressLZSS(memHandle.name, memHandle.data.data()))
+static bool make_cache_header(string_view name, const u8 *data, u32 size, CacheHeader &header)
+{
+	header = {};
+	header.magic = kCacheMagic;
+	header.size = size;
+	if (!source_stamp(name, header.sourceSize, header.sourceTime))
 	{
-		memHandle.loaded = true;
-		memHandle.hasScene = false;
-		memHandle.hasObjects = false;
-
-		load_chunks(i);
-
-		if (i == 0)
-		{
-			load_game_vars(i);
-		}
-		else if (i == 1)
-		{
-			load_objects(i);
-		}
-		else
-		{
-			load_scene(i);
-		}
-
-		load_processes(i);
+		return false;
 	}
+	header.hash = hash_bytes(data, size);
+	return true;
 }
 
-void Tinsel::unload_memhandle(u32 i)
+static bool read_cache(string_view name, u32 size, MappedFile &file)
 {
-	MemHandle &memHandle = memHandles[i];
-	if (!memHandle.loaded)
+	u64 sourceSize;
+	i64 sourceTime;
+	if (!source_stamp(name, sourceSize, sourceTime) || !file.open(file_path("cache/", name, ".bin"), false))
 	{
-		return;
+		return false;
+	}
+
+	bool valid = valid_cache(file, size, sourceSize, sourceTime);
+	if (!valid)
+	{
+		file.close();
 	}
+	return valid;
 }
 
-MemHandle* Tinsel::get_memhandle(u32 h)
+static void write_cache(string_view name, const u8 *data, u32 size)
 {
-	u32 index = h >> 25;
-	assert(index < memHandles.size());
+	CacheHeader header;
+	if (!make_cache_header(name, data, size, header))
+	{
+		return;
+	}
 
-	return &memHandles[h >> 25];
+	// Write under a temporary name so a partial entry is never picked up.
+	error_code error;
+	filesystem::create_directories("cache", error);
+	string path = file_path("cache/", name, ".bin");
+	ofstream output { path + ".tmp", ios::binary };
+	output.write((const char*)&header, sizeof(header));
+	output.write((const char*)data, size);
+	output.close();
+	if (output)
+	{
+		filesystem::rename(path + ".tmp", path, error);
+	}
+	if (!output || error)
+	{
+		filesystem::remove(path + ".tmp", error);
+	}
 }
 
-u32 Tinsel::get_offset(u32 h)
-{
-	return h & 0x01ffffff;
-}
+// Opt-in cache shared by processes on one host. Decompressed handles are
+// published as named POSIX shared memory segments laid out like the disk
+// cache, and listed in a directory file that is flock'ed while read or
+// appended, so each segment is written by exactly one process.
+static const char *kSharedDirectory = "cache/shared.dir";
 
-unique_ptr<istream> Tinsel::get_memory(u32 h)
+#ifndef _WIN32
+static bool write_all(int fd, const void *data, size_t size, size_t offset)
 {
-	u32 index = h >> 25;
-	assert(index < memHandles.size());
-	MemHandle &memHandle = memHandles[index];
-	if (!memHandle.loaded)
+	size_t done = 0;
+	while (done < size)
 	{
-		load_memhandle(index);
+		ssize_t n = pwrite(fd, (const u8*)data + done, size - done, offset + done);
+		if (n <= 0)
+		{
+			return false;
+		}
+		done += n;
 	}
-
-	u32 offset = get_offset(h);
-	string buf { (char*)(memHandle.data.data() + offset), memHandle.size - offset - 1 };
-	return make_unique<istringstream>(buf);
+	return true;
 }
 
-
-void Tinsel::load_chunks(u32 i)
+struct SharedDirectory
 {
-	MemHandle &memHandle = memHandles[i];
-	if (!memHandle.loaded)
+	int fd;
+
+	SharedDirectory(int operation)
 	{
-		return;
+		error_code error;
+		filesystem::create_directories("cache", error);
+		fd = ::open(kSharedDirectory, O_RDWR | O_CREAT, 0644);
+		if (fd >= 0 && flock(fd, operation) != 0)
+		{
+			::close(fd);
+			fd = -1;
+		}
 	}
-	u32 offset = 0;
-	while(true)
+
+	~SharedDirectory()
 	{
-		u32 next = *(u32*)(memHandle.data.data() + offset + 4);
+		if (fd >= 0)
+		{
+			flock(fd, LOCK_UN);
+			::close(fd);
+		}
+	}
 
-		Chunk& chunk = memHandle.chunks.emplace_back();
-		chunk.type = *(ChunkType*)(memHandle.data.data() + offset);
-		chunk.pos = offset;
-		if (next != 0)
+	// One segment name per line, followed by the handle name.
+	vector<string> lines()
+	{
+		vector<string> result;
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0)
 		{
-			chunk.size = next - offset;
+			return result;
 		}
-		else
+		string text(st.st_size, '\0');
+		if (pread(fd, text.data(), text.size(), 0) != (ssize_t)text.size())
 		{
-			chunk.size = memHandle.size - offset;
+			return result;
 		}
-		chunk.data = memHandle.data.data() + offset + 8;
-
-		offset = next;
+		istringstream input { text };
+		string line;
+		while (getline(input, line))
+		{
+			result.push_back(line);
+		}
+		return result;
+	}
 
-		if (offset == 0)
+	vector<string> segments()
+	{
+		vector<string> result;
+		for (auto& line : lines())
 		{
-			break;
+			result.push_back(line.substr(0, line.find(' ')));
 		}
+		return result;
 	}
-}
 
-void Tinsel::load_game_vars(u32 i)
-{
-	MemHandle& memHandle = memHandles[i];
-	for (auto& chunk : memHandle.chunks)
+	bool contains(const string &segment)
+	{
+		auto all = segments();
+		return find(all.begin(), all.end(), segment) != all.end();
+	}
+
+	bool append(const string &line)
 	{
-		if (chunk.type == ChunkType::CHUNK_GAME)
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			return false;
+		}
+		if (write_all(fd, line.data(), line.size(), st.st_size))
 		{
-			gameVars = *(GameVariables*)chunk.data;
+			return true;
 		}
+		// Cut the torn line off again. Should that fail too, the caller
+		// unlinks the segment and the line leads nowhere.
+		int truncated = ftruncate(fd, st.st_size);
+		(void)truncated;
+		return false;
 	}
-}
 
-void Tinsel::load_scene(u32 i)
-{
-	MemHandle& memHandle = memHandles[i];
-	for (auto& chunk : memHandle.chunks)
+	// Unlinks and forgets the segments published for the handle called
+	// name, made from earlier versions of its source.
+	bool remove_handle(string_view name)
 	{
-		if (chunk.type == ChunkType::CHUNK_SCENE)
-		{
-			istringstream data { { (char*)chunk.data, chunk.size } };
-
-			Scene& scene = memHandle.scene;
-
-			scene.defRefer = read_u32(data);
-			scene.hSceneScript = read_u32(data);
-			scene.hSceneDesc = read_u32(data);
-			scene.numEntrance = read_u32(data);
-			scene.hEntrance = read_u32(data);
-			scene.numCameras = read_u32(data);
-			scene.hCamera = read_u32(data);
-			scene.numLights = read_u32(data);
-			scene.hLight = read_u32(data);
-			scene.numPoly = read_u32(data);
-			scene.hPoly = read_u32(data);
-			scene.numTaggedActor = read_u32(data);
-			scene.hTaggedActor = read_u32(data);
-			scene.numProcess = read_u32(data);
-			scene.hProcess = read_u32(data);
-			scene.hMusicScript = read_u32(data);
-			scene.hMusicSegment = read_u32(data);
-
-			if (scene.numEntrance != 0 && scene.hEntrance != 0)
+		string kept;
+		bool removed = false;
+		for (auto& line : lines())
+		{
+			size_t space = line.find(' ');
+			if (space != string::npos && string_view { line }.substr(space + 1) == name)
 			{
-				auto data = get_memory(scene.hEntrance);
-				for (u32 i = 0; i < scene.numEntrance; ++i)
-				{
-					Entrance& entrance = scene.entrances.emplace_back();
-					entrance.handle = scene.hEntrance + (i * 16);
-					entrance.eNumber = read_u32(*data);
-					entrance.hScript = read_u32(*data);
-					entrance.hEntDesc = read_u32(*data);
-					entrance.flags = read_u32(*data);
-				}
+				shm_unlink(line.substr(0, space).c_str());
+				removed = true;
 			}
-
-			if (scene.numPoly != 0 && scene.hPoly != 0)
+			else
 			{
-				auto data = get_memory(scene.hPoly);
-				for (u32 i = 0; i < scene.numPoly; ++i)
-				{
-					Poly& poly = scene.polys.emplace_back();
-					poly.handle = scene.hPoly + (i * 136);
-
-					poly.type = read_u32(*data);
-					poly.x[0] = read_u32(*data);
-					poly.x[1] = read_u32(*data);
-					poly.x[2] = read_u32(*data);
-					poly.x[3] = read_u32(*data);
-					poly.y[0] = read_u32(*data);
-					poly.y[1] = read_u32(*data);
-					poly.y[2] = read_u32(*data);
-					poly.y[3] = read_u32(*data);
-					poly.xOff = read_u32(*data);
-					poly.yOff = read_u32(*data);
-					poly.id = read_u32(*data);
-					poly._ws = read_u32(*data);
-					poly.field = read_u32(*data);
-					poly.reftype = read_u32(*data);
-					poly.tagx = read_u32(*data);
-					poly.tagy = read_u32(*data);
-					poly.hTagText = read_u32(*data);
-					poly.nodeX = read_u32(*data);
-					poly.nodeY = read_u32(*data);
-					poly.hFilm = read_u32(*data);
-					poly.scale1 = read_u32(*data);
-					poly.scale2 = read_u32(*data);
-					poly.level1 = read_u32(*data);
-					poly.level2 = read_u32(*data);
-					poly.bright1 = read_u32(*data);
-					poly.bright2 = read_u32(*data);
-					poly.reelType = read_u32(*data);
-					poly.zFactor = read_u32(*data);
-					poly.nodeCount = read_u32(*data);
-					poly.nodeListX = read_u32(*data);
-					poly.nodeListY = read_u32(*data);
-					poly.lineList = read_u32(*data);
-					poly.hScript = read_u32(*data);
-				}
+				kept += line + "\n";
 			}
+		}
+		return !removed || (ftruncate(fd, 0) == 0 && write_all(fd, kept.data(), kept.size(), 0));
+	}
+};
 
+static string shared_segment(string_view name, u64 sourceSize, i64 sourceTime)
+{
+	error_code error;
+	string key = filesystem::absolute(file_path("data/", name), error).string();
+	u64 hash = hash_bytes((const u8*)key.data(), key.size()) ^ (sourceSize * 0x9e3779b97f4a7c15ull) ^ (u64)sourceTime;
+	char segment[64];
+	snprintf(segment, sizeof(segment), "/tinsel3viewer-%016llx", (unsigned long long)hash);
+	return segment;
+}
+#endif
 
-			if (scene.numTaggedActor != 0 && scene.hTaggedActor != 0)
-			{
-				auto data = get_memory(scene.hTaggedActor);
-				for (u32 i = 0; i < scene.numTaggedActor; ++i)
-				{
-					Actor& actor = scene.actors.emplace_back();
-					actor.handle = scene.hTaggedActor + (i * 28);
-
-					actor.id = read_u32(*data);
-					actor.hTagText = read_u32(*data);
-					actor.tagPortionV = read_u32(*data);
-					actor.tagPortionH = read_u32(*data);
-					actor.hActorCode = read_u32(*data);
-					actor.tagFlags = read_u32(*data);
-					actor.hOverrideTag = read_u32(*data);
-				}
-			}
+static bool read_shared(string_view name, u32 size, MappedFile &file)
+{
+#ifndef _WIN32
+	u64 sourceSize;
+	i64 sourceTime;
+	if (!source_stamp(name, sourceSize, sourceTime))
+	{
+		return false;
+	}
+	string segment = shared_segment(name, sourceSize, sourceTime);
 
-			memHandle.hasScene = true;
-		}
+	SharedDirectory directory { LOCK_SH };
+	if (directory.fd < 0 || !directory.contains(segment))
+	{
+		return false;
+	}
+	int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return false;
+	}
+	file.open_fd(fd, false);
+	::close(fd);
+	if (!file.is_open() || !valid_cache(file, size, sourceSize, sourceTime))
+	{
+		file.close();
+		return false;
 	}
+	return true;
+#else
+	return false;
+#endif
 }
 
-void Tinsel::load_objects(u32 i)
+static void write_shared(string_view name, const u8 *data, u32 size)
 {
-	MemHandle& memHandle = memHandles[i];
-	for (auto& chunk : memHandle.chunks)
+#ifndef _WIN32
+	CacheHeader header;
+	if (!make_cache_header(name, data, size, header))
 	{
-		if (chunk.type == ChunkType::CHUNK_OBJECTS)
-		{
-			istringstream data { { (char*)chunk.data, chunk.size } };
+		return;
+	}
+	string segment = shared_segment(name, header.sourceSize, header.sourceTime);
 
-			for (u32 i = 0; i < gameVars.numIcons; ++i)
-			{
-				Object& object = memHandle.objects.emplace_back();
+	SharedDirectory directory { LOCK_EX };
+	if (directory.fd < 0 || directory.contains(segment) || !directory.remove_handle(name))
+	{
+		return;
+	}
+	int fd = shm_open(segment.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		return;
+	}
+	bool written = ftruncate(fd, sizeof(header) + size) == 0
+		&& write_all(fd, &header, sizeof(header), 0)
+		&& write_all(fd, data, size, sizeof(header));
+	::close(fd);
+	if (!written)
+	{
+		shm_unlink(segment.c_str());
+		return;
+	}
+	if (!directory.append(segment + " " + string { name } + "\n"))
+	{
+		shm_unlink(segment.c_str());
+	}
+#endif
+}
 
-				object.handle = i * 24;
+// Removes every published segment, for when the memory is wanted back.
+// Processes that mapped them keep their mappings.
+bool Tinsel::clear_shared_cache()
+{
+#ifndef _WIN32
+	SharedDirectory directory { LOCK_EX };
+	if (directory.fd < 0)
+	{
+		return false;
+	}
+	for (auto& segment : directory.segments())
+	{
+		shm_unlink(segment.c_str());
+	}
+	return ftruncate(directory.fd, 0) == 0;
+#else
+	return true;
+#endif
+}
 
-				object.id = read_u32(data);
-				object.hIconFilm = read_u32(data);
-				object.hScript = read_u32(data);
-				object.attribute = read_u32(data);
-				object._u = read_u32(data);
-				object.notClue = read_u32(data);
-			}
+// Looks in the shared cache if enabled, then the disk cache.
+static bool read_any_cache(string_view name, u32 size, MappedFile &file, bool shared)
+{
+	return (shared && read_shared(name, size, file)) || read_cache(name, size, file);
+}
 
-			memHandle.hasObjects = true;
-		}
+bool Tinsel::open_cached(u32 i)
+{
+	MemHandle &memHandle = memHandles[i];
+	if (!read_any_cache(memHandle.name, memHandle.size, memHandle.cached, sharedCache))
+	{
+		return false;
 	}
+
+	memHandle.data = memHandle.cached.data + sizeof(CacheHeader);
+	memHandle.decoded = memHandle.size;
+	return true;
 }
 
-void Tinsel::load_processes(u32 i)
+void Tinsel::store_cached(u32 i)
 {
-	MemHandle& memHandle = memHandles[i];
-	if (i == 0)
+	MemHandle &memHandle = memHandles[i];
+	if (memHandle.decoded == memHandle.size)
 	{
-		for (auto& chunk : memHandle.chunks)
+		write_cache(memHandle.name, memHandle.data, memHandle.size);
+		if (sharedCache)
 		{
-			if (chunk.type == ChunkType::CHUNK_MASTER_SCRIPT)
-			{
-				u32 handle = *(u32*)chunk.data;
+			write_shared(memHandle.name, memHandle.data, memHandle.size);
+		}
+	}
+}
 
-				PcodeScript &src = memHandle.scripts.emplace_back();
-				src.handle = handle;
-				src.name = "master script";
-				src.disassembly = pcode_disassemble(*get_memory(handle));
-			}
+void Tinsel::load_index()
+{
+	if (!index.open("data/index"))
+	{
+		return;
+	}
+
+	const IndexRecord *records = (const IndexRecord*)index.data;
+	size_t count = index.size / sizeof(IndexRecord);
+
+	for(u32 i = 0; i < count; ++i)
+	{
+		const IndexRecord &record = records[i];
+		MemHandle &memHandle = memHandles.emplace_back();
+		memHandle.id = i;
+		memHandle.name = record.name_view();
+		memHandle.size = record.size;
+		memHandle.flags = record.flags;
+
+		memHandle.loaded = false;
+		memHandle.loading = false;
+		memHandle.pinned = false;
+		memHandle.lastUsed = 0;
+		memHandle.data = nullptr;
+		memHandle.decoded = 0;
+		memHandle.ready = false;
+		memHandle.stats = {};
+		memHandle.memory = {};
+
+		if (memHandle.flags & (u32)MemHandleFlags::Preload)
+		{
+			load_memhandle(i);
+		}
+
+	}
+}
+
+// Prepares the handle for reading without decompressing anything yet,
+// data is decoded on demand through MemHandle::fill.
+bool Tinsel::open_memhandle(u32 i)
+{
+	MemHandle &memHandle = memHandles[i];
+	if (memHandle.ready.load(memory_order_acquire))
+	{
+		return true;
+	}
+
+	lock_guard<mutex> lock { memHandle.decodeMutex };
+	if (memHandle.stream || memHandle.decoded != 0)
+	{
+		return true;
+	}
+
+	if (open_cached(i))
+	{
+		memHandle.ready.store(true, memory_order_release);
+		return true;
+	}
+
+	if (!memHandle.source.open(file_path("data/", memHandle.name)))
+	{
+		return false;
+	}
+
+	memHandle.buffer.resize(memHandle.size);
+	memHandle.data = memHandle.buffer.data();
+	memHandle.stream = make_unique<LzssStream>();
+	memHandle.stream->init(memHandle.source.data, memHandle.source.size);
+	if (collectStats)
+	{
+		memHandle.stats = {};
+		memHandle.stats.inputBytes = memHandle.source.size;
+		memHandle.stream->stats = &memHandle.stats;
+	}
+	return true;
+}
+
+static const size_t kArenaBlockSize = 16 * 1024;
+
+MemHandle::MemHandle()
+: arena { kArenaBlockSize, &arenaBlocks }
+, chunks { &arena }
+, scripts { &arena }
+, chunkTypeStart {}
+, chunkIndex { &arena }
+, catalogued { false }
+, hasScene { false }
+, scene { &arena }
+, hasObjects { false }
+, objects { &arena }
+{
+}
+
+// Empties the containers without giving their storage back one piece at a
+// time, then drops the whole arena.
+template<typename T>
+static void release(pmr::vector<T> &v)
+{
+	pmr::vector<T> { v.get_allocator() }.swap(v);
+}
+
+void MemHandle::release_parsed()
+{
+	release(chunks);
+	release(scripts);
+	chunkTypeStart.fill(0);
+	release(chunkIndex);
+	hasScene = false;
+	(SceneRecord&)scene = {};
+	release(scene.entrances);
+	release(scene.polys);
+	release(scene.actors);
+	hasObjects = false;
+	release(objects);
+	arena.release();
+}
+
+ChunkRange MemHandle::chunks_of(ChunkType type) const
+{
+	u32 slot = chunk_slot(type);
+	const u32 *first = chunkIndex.data() + chunkTypeStart[slot];
+	const u32 *last = chunkIndex.data() + chunkTypeStart[slot + 1];
+	if (slot == kChunkSlots - 1)
+	{
+		// unknown types share a slot, skip to the ones asked for
+		while (first != last && chunks[*first].type != type)
+		{
+			++first;
+		}
+		const u32 *end = first;
+		while (end != last && chunks[*end].type == type)
+		{
+			++end;
+		}
+		last = end;
+	}
+	return { chunks.data(), first, last };
+}
+
+const Chunk* MemHandle::find_chunk(ChunkType type) const
+{
+	ChunkRange range = chunks_of(type);
+	return range.empty() ? nullptr : &*range.begin();
+}
+
+size_t MemHandle::fill(size_t end)
+{
+	// Decode a bit past what was asked for, so that a parser walking
+	// through the data does not resume the decoder on every read.
+	static const size_t kDecodeAhead = 16 * 1024;
+
+	if (ready.load(memory_order_acquire))
+	{
+		return decoded;
+	}
+
+	lock_guard<mutex> lock { decodeMutex };
+	if (stream && decoded < end)
+	{
+		auto start = chrono::steady_clock::now();
+		size_t before = decoded;
+		decoded = stream->decode(buffer.data(), buffer.size(), end + kDecodeAhead);
+		if (stream->stats)
+		{
+			stream->stats->outputBytes += decoded - before;
+			stream->stats->seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+		if (stream->finished || decoded == buffer.size())
+		{
+			stream.reset();
+			source.close();
+			ready.store(true, memory_order_release);
+		}
+	}
+	return decoded;
+}
+
+// Safe to call from several threads, each handle is parsed exactly once
+// and the others wait for it.
+void Tinsel::load_memhandle(u32 i)
+{
+	MemHandle &memHandle = memHandles[i];
+	memHandle.lastUsed = ++useClock;
+	if (memHandle.loaded.load(memory_order_acquire))
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock { memHandle.loadMutex };
+	if (memHandle.loaded.load(memory_order_relaxed))
+	{
+		return;
+	}
+	record_access(AccessKind::Load, Handle(i, 0));
+
+	if (!open_memhandle(i))
+	{
+		return;
+	}
+
+	if (memHandle.fill(memHandle.size) != 0)
+	{
+		if (!memHandle.cached.is_open())
+		{
+			store_cached(i);
+		}
+
+		memHandle.hasScene = false;
+		memHandle.hasObjects = false;
+
+		load_chunks(i);
+
+		if (i == 0)
+		{
+			load_game_vars(i);
+		}
+		else if (i == 1)
+		{
+			load_objects(i);
+		}
+		else
+		{
+			load_scene(i);
+		}
+
+		load_processes(i);
+		measure_memory(i);
+
+		memHandle.loaded.store(true, memory_order_release);
+	}
+}
+
+// Reads the compressed file on an I/O thread and hands it to a worker for
+// decompression, so reading the next file overlaps decoding this one.
+// Background loads only run while no other load is waiting.
+// Parsing still happens in publish_loaded, because it may resolve handles
+// in other MemHandles.
+void Tinsel::load_memhandle_async(u32 i, bool background)
+{
+	MemHandle &memHandle = memHandles[i];
+	if (memHandle.loaded || memHandle.loading)
+	{
+		return;
+	}
+
+	if (!workers)
+	{
+		workers = make_unique<WorkerPool>();
+		ioWorkers = make_unique<WorkerPool>(2);
+	}
+
+	memHandle.loading = true;
+	if (!background)
+	{
+		loadsQueued++;
+	}
+	ioWorkers->submit([this, i, name = memHandle.name, size = memHandle.size, stats = collectStats, shared = sharedCache, background] {
+		LoadResult result {};
+		result.id = i;
+		result.background = background;
+		if (read_any_cache(name, size, result.cached, shared))
+		{
+			lock_guard<mutex> lock { loadResultsMutex };
+			loadResults.push_back(std::move(result));
+			return;
+		}
+
+		auto start = chrono::steady_clock::now();
+		auto input = make_shared<MappedFile>();
+		input->load(file_path("data/", name));
+		double readSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		{
+			unique_lock<mutex> lock { readAheadMutex };
+			readAheadReady.wait(lock, [this] { return readAheadBytes < kReadAheadLimit; });
+			readAheadBytes += input->size;
+		}
+
+		workers->submit([this, i, size, input, stats, readSeconds, background] {
+			LoadResult result {};
+			result.id = i;
+			result.background = background;
+			if (input->is_open())
+			{
+				result.data.resize(size);
+				result.decoded = decompressLZSS(input->data, input->size, result.data.data(), size, LzssDecoder::Window, stats ? &result.stats : nullptr);
+				if (stats)
+				{
+					result.stats.readSeconds = readSeconds;
+				}
+			}
+
+			{
+				lock_guard<mutex> lock { readAheadMutex };
+				readAheadBytes -= input->size;
+			}
+			readAheadReady.notify_one();
+			input->close();
+
+			lock_guard<mutex> lock { loadResultsMutex };
+			loadResults.push_back(std::move(result));
+		}, background);
+	}, background);
+}
+
+// Other MemHandles that the scene or objects parsed from handle i point
+// into, in the order they were found.
+vector<u32> Tinsel::referenced_memhandles(u32 i) const
+{
+	const MemHandle &memHandle = memHandles[i];
+	vector<u32> result;
+	auto add = [&](Handle h) {
+		if (h && is_valid(h) && h.index() != i && find(result.begin(), result.end(), h.index()) == result.end())
+		{
+			result.push_back(h.index());
+		}
+	};
+
+	if (memHandle.hasScene)
+	{
+		const Scene &scene = memHandle.scene;
+		add(scene.hSceneScript);
+		add(scene.hEntrance);
+		add(scene.hPoly);
+		add(scene.hTaggedActor);
+		add(scene.hProcess);
+		for (auto& ent : scene.entrances)
+		{
+			add(ent.hScript);
+		}
+		for (auto& poly : scene.polys)
+		{
+			add(poly.hFilm);
+			add(poly.hScript);
+		}
+		for (auto& actor : scene.actors)
+		{
+			add(actor.hActorCode);
+		}
+	}
+
+	if (memHandle.hasObjects)
+	{
+		for (auto& object : memHandle.objects)
+		{
+			add(object.hIconFilm);
+			add(object.hScript);
+		}
+	}
+	return result;
+}
+
+// Warms the handles a loaded scene refers to on the background queues, so
+// following a film or script from it does not wait on decompression.
+void Tinsel::prefetch_referenced(u32 i)
+{
+	if (!memHandles[i].loaded)
+	{
+		return;
+	}
+
+	for (u32 id : referenced_memhandles(i))
+	{
+		if (memHandles[id].data == nullptr)
+		{
+			load_memhandle_async(id, true);
+		}
+	}
+}
+
+// Rebuilds the scene graph from the hopper and the handles loaded now, so
+// the more scenes are loaded the more links it knows. Scripts of loaded
+// scenes are disassembled to find their scene changes.
+void Tinsel::build_scene_graph()
+{
+	SceneGraph graph;
+	graph.hopper = SceneGraph::kNone;
+	graph.nodeOfMemHandle.assign(memHandles.size(), SceneGraph::kNone);
+
+	vector<vector<HopperEntry>> nodeEntrances;
+	auto node_for = [&](u32 id)
+	{
+		u32 &node = graph.nodeOfMemHandle[id];
+		if (node == SceneGraph::kNone)
+		{
+			node = graph.nodes.size();
+			graph.nodes.push_back({ id, 0, 0, 0 });
+			graph.nodeOfName.emplace(memHandles[id].name, node);
+			nodeEntrances.emplace_back();
+		}
+		return node;
+	};
+
+	struct Link
+	{
+		u32 from;
+		SceneGraph::Edge edge;
+	};
+	vector<Link> links;
+
+	// The hopper, normally in the inventory objects file, links the node
+	// of the handle holding it to each entrance it lists.
+	for (auto& memHandle : memHandles)
+	{
+		const Chunk *scenes = memHandle.loaded ? memHandle.find_chunk(ChunkType::CHUNK_SCENE_HOPPER) : nullptr;
+		const Chunk *entries = memHandle.loaded ? memHandle.find_chunk(ChunkType::CHUNK_SCENE_HOPPER2) : nullptr;
+		if (scenes == nullptr || entries == nullptr)
+		{
+			continue;
+		}
+
+		vector<HopperScene> hopperScenes;
+		Reader data { scenes->data, scenes->size - 8 };
+		read_records<HopperScene>(data, (scenes->size - 8) / Schema<HopperScene>::size, Handle(memHandle.id, scenes->pos + 8).value, hopperScenes);
+		vector<HopperEntry> hopperEntries;
+		data = Reader { entries->data, entries->size - 8 };
+		read_records<HopperEntry>(data, (entries->size - 8) / Schema<HopperEntry>::size, Handle(memHandle.id, entries->pos + 8).value, hopperEntries);
+
+		graph.hopper = node_for(memHandle.id);
+		for (auto& hopperScene : hopperScenes)
+		{
+			if (!is_valid(hopperScene.hScene))
+			{
+				continue;
+			}
+			u32 node = node_for(Handle(hopperScene.hScene).index());
+			graph.nodes[node].hSceneDesc = hopperScene.hSceneDesc;
+			for (u32 e = hopperScene.entIndex; e < hopperScene.entIndex + hopperScene.numEnt && e < hopperEntries.size(); ++e)
+			{
+				nodeEntrances[node].push_back(hopperEntries[e]);
+				links.push_back({ graph.hopper, { node, hopperEntries[e].eNumber } });
+			}
+		}
+		break;
+	}
+
+	// NEWSCENE and HOOKSCENE take the scene, the entrance and a transition,
+	// links are only known where the first two are pushed as constants.
+	// Scripts are scanned rather than disassembled, which would keep their
+	// lines in the arena.
+	const u32 newScene = pcode_lib_code("NEWSCENE");
+	const u32 hookScene = pcode_lib_code("HOOKSCENE");
+	for (u32 id = 0; id < memHandles.size(); ++id)
+	{
+		MemHandle &memHandle = memHandles[id];
+		if (!memHandle.loaded)
+		{
+			continue;
+		}
+		if (memHandle.hasScene)
+		{
+			u32 node = node_for(id);
+			if (nodeEntrances[node].empty())
+			{
+				for (auto& entrance : memHandle.scene.entrances)
+				{
+					nodeEntrances[node].push_back({ entrance.handle, entrance.eNumber, entrance.hEntDesc, entrance.flags });
+				}
+			}
+		}
+
+		for (auto& script : memHandle.scripts)
+		{
+			vector<u32> constants;
+			pcode_scan(get_memory(script.handle), [&](u32 opcode, u32 argument)
+			{
+				switch (opcode)
+				{
+				case OP_IMM:
+					constants.push_back(argument);
+					break;
+				case OP_ZERO:
+					constants.push_back(0);
+					break;
+				case OP_ONE:
+					constants.push_back(1);
+					break;
+				case OP_MINUSONE:
+					constants.push_back(0xFFFFFFFF);
+					break;
+				case OP_LIBCALL:
+					if ((argument == newScene || argument == hookScene) && constants.size() >= 3)
+					{
+						u32 hScene = constants[constants.size() - 3];
+						if (is_valid(hScene))
+						{
+							u32 to = node_for(Handle(hScene).index());
+							links.push_back({ node_for(id), { to, constants[constants.size() - 2] } });
+						}
+					}
+					constants.clear();
+					break;
+				default:
+					constants.clear();
+				}
+			});
+		}
+	}
+
+	for (u32 node = 0; node < graph.nodes.size(); ++node)
+	{
+		auto &list = nodeEntrances[node];
+		sort(list.begin(), list.end(), [](const HopperEntry &a, const HopperEntry &b) { return a.eNumber < b.eNumber; });
+		graph.nodes[node].firstEntrance = graph.entrances.size();
+		graph.nodes[node].numEntrances = list.size();
+		graph.entrances.insert(graph.entrances.end(), list.begin(), list.end());
+	}
+
+	sort(links.begin(), links.end(), [](const Link &a, const Link &b)
+	{
+		return tie(a.from, a.edge.to, a.edge.entrance) < tie(b.from, b.edge.to, b.edge.entrance);
+	});
+	links.erase(unique(links.begin(), links.end(), [](const Link &a, const Link &b)
+	{
+		return a.from == b.from && a.edge.to == b.edge.to && a.edge.entrance == b.edge.entrance;
+	}), links.end());
+
+	graph.edgeStart.assign(graph.nodes.size() + 1, 0);
+	graph.edges.reserve(links.size());
+	for (auto& link : links)
+	{
+		++graph.edgeStart[link.from + 1];
+		graph.edges.push_back(link.edge);
+	}
+	for (u32 node = 0; node < graph.nodes.size(); ++node)
+	{
+		graph.edgeStart[node + 1] += graph.edgeStart[node];
+	}
+
+	sceneGraph = std::move(graph);
+}
+
+u32 SceneGraph::find(string_view name) const
+{
+	auto found = nodeOfName.find(name);
+	return found != nodeOfName.end() ? found->second : kNone;
+}
+
+u32 SceneGraph::find(Handle hScene) const
+{
+	return hScene.index() < nodeOfMemHandle.size() ? nodeOfMemHandle[hScene.index()] : kNone;
+}
+
+const HopperEntry* SceneGraph::find_entrance(u32 node, u32 eNumber) const
+{
+	auto first = entrances.begin() + nodes[node].firstEntrance;
+	auto last = first + nodes[node].numEntrances;
+	auto found = lower_bound(first, last, eNumber, [](const HopperEntry &entrance, u32 n) { return entrance.eNumber < n; });
+	return found != last && found->eNumber == eNumber ? &*found : nullptr;
+}
+
+// Nodes reachable from a node, itself included, in breadth first order.
+vector<u32> SceneGraph::reachable(u32 from) const
+{
+	if (from >= nodes.size())
+	{
+		return {};
+	}
+	vector<u32> order { from };
+	vector<bool> seen(nodes.size(), false);
+	seen[from] = true;
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		u32 node = order[k];
+		for (u32 e = edgeStart[node]; e < edgeStart[node + 1]; ++e)
+		{
+			if (!seen[edges[e].to])
+			{
+				seen[edges[e].to] = true;
+				order.push_back(edges[e].to);
+			}
+		}
+	}
+	return order;
+}
+
+// Fewest scene changes from one node to another, both ends included, empty
+// if there is no way.
+vector<u32> SceneGraph::path(u32 from, u32 to) const
+{
+	if (from >= nodes.size() || to >= nodes.size())
+	{
+		return {};
+	}
+	vector<u32> parent(nodes.size(), kNone);
+	vector<u32> queue { from };
+	parent[from] = from;
+	for (size_t k = 0; k < queue.size() && parent[to] == kNone; ++k)
+	{
+		u32 node = queue[k];
+		for (u32 e = edgeStart[node]; e < edgeStart[node + 1]; ++e)
+		{
+			if (parent[edges[e].to] == kNone)
+			{
+				parent[edges[e].to] = node;
+				queue.push_back(edges[e].to);
+			}
+		}
+	}
+	if (parent[to] == kNone)
+	{
+		return {};
+	}
+	vector<u32> route { to };
+	while (route.back() != from)
+	{
+		route.push_back(parent[route.back()]);
+	}
+	reverse(route.begin(), route.end());
+	return route;
+}
+
+// Set by publish_loaded while it parses a background load.
+static thread_local bool traceSuspended = false;
+
+// Installs and parses finished background loads until the time budget is
+// spent, returns how many were published.
+u32 Tinsel::publish_loaded(double budgetSeconds)
+{
+	auto start = chrono::steady_clock::now();
+	u32 published = 0;
+	while (true)
+	{
+		LoadResult result;
+		{
+			lock_guard<mutex> lock { loadResultsMutex };
+			if (loadResults.empty())
+			{
+				break;
+			}
+			result = std::move(loadResults.back());
+			loadResults.pop_back();
+		}
+
+		// A handle a parser already opened keeps its own data, Readers may
+		// point into it. load_memhandle then finishes decoding that instead.
+		MemHandle &memHandle = memHandles[result.id];
+		if (!memHandle.loaded)
+		{
+			lock_guard<mutex> lock { memHandle.decodeMutex };
+			if (memHandle.data == nullptr && result.cached.is_open())
+			{
+				memHandle.cached = std::move(result.cached);
+				memHandle.data = memHandle.cached.data + sizeof(CacheHeader);
+				memHandle.decoded = memHandle.size;
+				memHandle.ready.store(true, memory_order_release);
+			}
+			else if (memHandle.data == nullptr && result.decoded != 0)
+			{
+				memHandle.buffer = std::move(result.data);
+				memHandle.data = memHandle.buffer.data();
+				memHandle.decoded = result.decoded;
+				memHandle.stats = result.stats;
+				memHandle.ready.store(true, memory_order_release);
+			}
+		}
+		// Handles warmed in the background were not touched by the user,
+		// parsing them stays out of the trace.
+		if (memHandle.data != nullptr)
+		{
+			traceSuspended = result.background;
+			load_memhandle(result.id);
+			traceSuspended = false;
+		}
+		memHandle.loading = false;
+		if (!result.background)
+		{
+			loadsDone++;
+		}
+		published++;
+
+		if (chrono::duration<double>(chrono::steady_clock::now() - start).count() > budgetSeconds)
+		{
+			break;
+		}
+	}
+
+	if (loadsDone == loadsQueued)
+	{
+		loadsQueued = 0;
+		loadsDone = 0;
+	}
+	return published;
+}
+
+// Drops the decompressed data and everything parsed from it, the handle
+// can be loaded again later. Pointers into its chunks, scripts, scene or
+// objects are invalid afterwards. Not thread safe, no other thread may be
+// loading or reading handles meanwhile.
+void Tinsel::unload_memhandle(u32 i)
+{
+	if (!can_unload(i))
+	{
+		return;
+	}
+
+	MemHandle &memHandle = memHandles[i];
+	memHandle.loaded = false;
+	memHandle.ready = false;
+	memHandle.data = nullptr;
+	memHandle.decoded = 0;
+	memHandle.buffer = {};
+	memHandle.cached.close();
+	memHandle.source.close();
+	memHandle.stream.reset();
+	memHandle.checkpoints.reset();
+
+	memHandle.release_parsed();
+
+	if (memHandle.catalogued)
+	{
+		lock_guard<mutex> lock { catalogMutex };
+		for (auto& [type, handles] : catalog)
+		{
+			handles.erase(remove_if(handles.begin(), handles.end(), [i](Handle h) { return h.index() == i; }), handles.end());
+		}
+		memHandle.catalogued = false;
+	}
+
+	size_t textures = memHandle.memory.textures;
+	memHandle.memory = {};
+	memHandle.memory.textures = textures;
+}
+
+// Preload handles and the strings are only read once at startup, handles
+// with a background load in flight are installed by publish_loaded.
+bool Tinsel::can_unload(u32 i) const
+{
+	const MemHandle &memHandle = memHandles[i];
+	return i != stringsId
+		&& (memHandle.flags & (u32)MemHandleFlags::Preload) == 0
+		&& !memHandle.loading;
+}
+
+static size_t resident_bytes(const MemHandle &memHandle)
+{
+	return (memHandle.data != nullptr ? memHandle.size : 0) + memHandle.memory.parsed();
+}
+
+// Bytes held by decompressed data and what was parsed from it, including
+// handles only opened for reading by a parser and not fully loaded.
+size_t Tinsel::resident_bytes() const
+{
+	size_t total = 0;
+	for (auto& memHandle : memHandles)
+	{
+		total += ::resident_bytes(memHandle);
+	}
+	return total;
+}
+
+// Heap bytes behind a string, nothing while it fits the small buffer. The
+// buffer's size differs between standard libraries, so check where the
+// characters live instead.
+template<typename A>
+static size_t heap_bytes(const basic_string<char, char_traits<char>, A> &s)
+{
+	less<const void*> before;
+	bool inside = !before(s.data(), &s) && before(s.data(), &s + 1);
+	return inside ? 0 : s.capacity() + 1;
+}
+
+template<typename T, typename A>
+static size_t heap_bytes(const vector<T, A> &v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+void Tinsel::measure_memory(u32 i)
+{
+	MemHandle &memHandle = memHandles[i];
+	MemoryUsage &memory = memHandle.memory;
+
+	memory.chunks = heap_bytes(memHandle.chunks) + heap_bytes(memHandle.chunkIndex);
+
+	memory.scripts = heap_bytes(memHandle.scripts);
+	for (auto& script : memHandle.scripts)
+	{
+		memory.scripts += heap_bytes(script.name) + heap_bytes(script.disassembly);
+		for (auto& line : script.disassembly)
+		{
+			memory.scripts += heap_bytes(line.opcodeStr) + heap_bytes(line.argumentStr);
+		}
+	}
+
+	memory.scene = heap_bytes(memHandle.scene.entrances)
+		+ heap_bytes(memHandle.scene.polys)
+		+ heap_bytes(memHandle.scene.actors);
+	memory.objects = heap_bytes(memHandle.objects);
+
+	size_t used = memory.chunks + memory.scripts + memory.scene + memory.objects;
+	memory.slack = memHandle.arenaBlocks.bytes > used ? memHandle.arenaBlocks.bytes - used : 0;
+}
+
+MemoryUsage Tinsel::memory_usage(u32 i) const
+{
+	const MemHandle &memHandle = memHandles[i];
+	MemoryUsage memory = memHandle.memory;
+	memory.data = memHandle.data != nullptr ? memHandle.size : 0;
+	return memory;
+}
+
+// Evicts the least recently used unpinned handles until the resident size
+// fits memoryBudget. Must not run while a parser holds a Reader, the
+// viewer calls it once per frame between loading and drawing.
+void Tinsel::trim_memory()
+{
+	if (memoryBudget == 0)
+	{
+		return;
+	}
+
+	size_t resident = resident_bytes();
+	if (resident <= memoryBudget)
+	{
+		return;
+	}
+
+	vector<u32> candidates;
+	for (auto& memHandle : memHandles)
+	{
+		if (memHandle.data != nullptr && !memHandle.pinned && can_unload(memHandle.id))
+		{
+			candidates.push_back(memHandle.id);
+		}
+	}
+	sort(candidates.begin(), candidates.end(), [this](u32 a, u32 b) {
+		return memHandles[a].lastUsed < memHandles[b].lastUsed;
+	});
+
+	for (u32 i : candidates)
+	{
+		if (resident <= memoryBudget)
+		{
+			break;
+		}
+		resident -= ::resident_bytes(memHandles[i]);
+		unload_memhandle(i);
+	}
+}
+
+// True if h points inside a known MemHandle, regardless of whether that
+// is loaded.
+bool Tinsel::is_valid(Handle h) const
+{
+	return h.index() < memHandles.size() && h.offset() < memHandles[h.index()].size;
+}
+
+MemHandle* Tinsel::get_memhandle(Handle h)
+{
+	if (h.index() >= memHandles.size())
+	{
+		return nullptr;
+	}
+	return &memHandles[h.index()];
+}
+
+// The one step from a handle to its bytes: checks the handle, opens the
+// MemHandle for on-demand decoding and returns a Reader bounded by the end
+// of the data. Invalid handles give a Reader that is already failed.
+Reader Tinsel::get_memory(Handle h)
+{
+	if (!is_valid(h) || !open_memhandle(h.index()))
+	{
+		return Reader {};
+	}
+
+	MemHandle &memHandle = memHandles[h.index()];
+	memHandle.lastUsed = ++useClock;
+	record_access(AccessKind::Memory, h);
+	u32 offset = h.offset();
+	u32 decoded = memHandle.fill(0);
+	u32 available = decoded > offset ? decoded - offset : 0;
+	ReaderSource *source = memHandle.ready.load(memory_order_acquire) ? nullptr : &memHandle;
+	return Reader { memHandle.data + offset, memHandle.size - offset, available, source, offset };
+}
+
+
+// Copies len bytes at handle h without decompressing the whole file. If they
+// are not decoded yet they are decoded from the nearest checkpoint, the
+// checkpoint index is built on first use and kept in data/<name>.lzi.
+u32 Tinsel::read_window(Handle h, u8 *dst, u32 len)
+{
+	if (!is_valid(h))
+	{
+		return 0;
+	}
+	MemHandle &memHandle = memHandles[h.index()];
+
+	u32 offset = h.offset();
+	len = min(len, memHandle.size - offset);
+
+	if (memHandle.ready.load(memory_order_acquire) && memHandle.decoded >= offset + len)
+	{
+		memcpy(dst, memHandle.data + offset, len);
+		return len;
+	}
+
+	lock_guard<mutex> lock { memHandle.decodeMutex };
+	if (memHandle.decoded >= offset + len)
+	{
+		memcpy(dst, memHandle.data + offset, len);
+		return len;
+	}
+
+	if (!memHandle.source.is_open() && !memHandle.source.open(file_path("data/", memHandle.name)))
+	{
+		return 0;
+	}
+
+	if (!memHandle.checkpoints)
+	{
+		// The saved index is tied to the source by its sizes and time, without
+		// a stamp it is built and not kept.
+		string path = file_path("data/", memHandle.name, ".lzi");
+		u64 sourceSize;
+		i64 sourceTime;
+		bool stamped = source_stamp(memHandle.name, sourceSize, sourceTime);
+		memHandle.checkpoints = make_unique<LzssIndex>();
+		if (!stamped || !memHandle.checkpoints->load(path, memHandle.source.size, memHandle.size, sourceTime))
+		{
+			memHandle.checkpoints->build(memHandle.source.data, memHandle.source.size, memHandle.size);
+			if (stamped)
+			{
+				memHandle.checkpoints->sourceTime = sourceTime;
+				memHandle.checkpoints->save(path);
+			}
+		}
+	}
+
+	return memHandle.checkpoints->decode_range(memHandle.source.data, memHandle.source.size, offset, len, dst);
+}
+
+void Tinsel::load_chunks(u32 i)
+{
+	MemHandle &memHandle = memHandles[i];
+	if (memHandle.data == nullptr)
+	{
+		return;
+	}
+	// The arena keeps whatever a growing vector leaves behind, count first.
+	u32 count = 1;
+	for (u32 offset = *(const u32*)(memHandle.data + 4); offset != 0; offset = *(const u32*)(memHandle.data + offset + 4))
+	{
+		++count;
+	}
+	memHandle.chunks.reserve(count);
+
+	u32 offset = 0;
+	while(true)
+	{
+		u32 next = *(const u32*)(memHandle.data + offset + 4);
+
+		Chunk& chunk = memHandle.chunks.emplace_back();
+		chunk.type = *(const ChunkType*)(memHandle.data + offset);
+		chunk.pos = offset;
+		if (next != 0)
+		{
+			chunk.size = next - offset;
+		}
+		else
+		{
+			chunk.size = memHandle.size - offset;
+		}
+		chunk.data = memHandle.data + offset + 8;
+
+		offset = next;
+
+		if (offset == 0)
+		{
+			break;
+		}
+	}
+
+	// Counting sort by type slot, keeping file order within a slot.
+	auto &start = memHandle.chunkTypeStart;
+	start.fill(0);
+	for (auto& chunk : memHandle.chunks)
+	{
+		++start[chunk_slot(chunk.type) + 1];
+	}
+	for (u32 slot = 1; slot <= kChunkSlots; ++slot)
+	{
+		start[slot] += start[slot - 1];
+	}
+	memHandle.chunkIndex.resize(memHandle.chunks.size());
+	array<u32, kChunkSlots> next = {};
+	for (u32 c = 0; c < memHandle.chunks.size(); ++c)
+	{
+		u32 slot = chunk_slot(memHandle.chunks[c].type);
+		memHandle.chunkIndex[start[slot] + next[slot]++] = c;
+	}
+	// unknown types share the last slot, group them so chunks_of can
+	// return a contiguous run
+	stable_sort(memHandle.chunkIndex.begin() + start[kChunkSlots - 1], memHandle.chunkIndex.end(), [&](u32 a, u32 b)
+	{
+		return (u32)memHandle.chunks[a].type < (u32)memHandle.chunks[b].type;
+	});
+
+	if (chunkCatalog)
+	{
+		add_to_catalog(memHandle);
+	}
+}
+
+// Called with the handle's loadMutex held, or before any loading.
+void Tinsel::add_to_catalog(MemHandle &memHandle)
+{
+	if (memHandle.catalogued || memHandle.chunks.empty())
+	{
+		return;
+	}
+	lock_guard<mutex> lock { catalogMutex };
+	for (auto& chunk : memHandle.chunks)
+	{
+		catalog[chunk.type].push_back(Handle { memHandle.id, chunk.pos });
+	}
+	memHandle.catalogued = true;
+}
+
+// Starts cataloguing chunks, picking up the handles already loaded.
+void Tinsel::enable_chunk_catalog()
+{
+	if (chunkCatalog.exchange(true))
+	{
+		return;
+	}
+	for (auto& memHandle : memHandles)
+	{
+		lock_guard<mutex> lock { memHandle.loadMutex };
+		add_to_catalog(memHandle);
+	}
+}
+
+// Handles of every catalogued chunk of a type, each pointing at the chunk
+// header. Empty unless enable_chunk_catalog was called.
+vector<Handle> Tinsel::find_chunks(ChunkType type) const
+{
+	lock_guard<mutex> lock { catalogMutex };
+	auto it = catalog.find(type);
+	if (it == catalog.end())
+	{
+		return {};
+	}
+	return it->second;
+}
+
+void Tinsel::load_game_vars(u32 i)
+{
+	MemHandle& memHandle = memHandles[i];
+	if (const Chunk *chunk = memHandle.find_chunk(ChunkType::CHUNK_GAME))
+	{
+		gameVars = *(const GameVariables*)chunk->data;
+	}
+}
+
+void Tinsel::load_scene(u32 i)
+{
+	MemHandle& memHandle = memHandles[i];
+	for (auto& chunk : memHandle.chunks_of(ChunkType::CHUNK_SCENE))
+	{
+		Reader data { chunk.data, chunk.size - 8 };
+
+		Scene& scene = memHandle.scene;
+		scene.handle = Handle(i, chunk.pos + 8).value;
+		read_record<SceneRecord>(data, scene);
+
+		if (scene.numEntrance != 0 && scene.hEntrance != 0)
+		{
+			auto data = get_memory(scene.hEntrance);
+			read_records<Entrance>(data, scene.numEntrance, scene.hEntrance, scene.entrances);
+		}
+
+		if (scene.numPoly != 0 && scene.hPoly != 0)
+		{
+			auto data = get_memory(scene.hPoly);
+			read_records<Poly>(data, scene.numPoly, scene.hPoly, scene.polys);
+		}
+
+		if (scene.numTaggedActor != 0 && scene.hTaggedActor != 0)
+		{
+			auto data = get_memory(scene.hTaggedActor);
+			read_records<Actor>(data, scene.numTaggedActor, scene.hTaggedActor, scene.actors);
+		}
+
+		memHandle.hasScene = true;
+	}
+}
+
+void Tinsel::load_objects(u32 i)
+{
+	MemHandle& memHandle = memHandles[i];
+	for (auto& chunk : memHandle.chunks_of(ChunkType::CHUNK_OBJECTS))
+	{
+		Reader data { chunk.data, chunk.size - 8 };
+
+		// object handles are offsets into the table, not into the MemHandle
+		read_records<Object>(data, gameVars.numIcons, 0, memHandle.objects);
+
+		memHandle.hasObjects = true;
+	}
+}
+
+void Tinsel::load_processes(u32 i)
+{
+	MemHandle& memHandle = memHandles[i];
+	if (i == 0)
+	{
+		if (const Chunk *chunk = memHandle.find_chunk(ChunkType::CHUNK_MASTER_SCRIPT))
+		{
+			u32 handle = *(const u32*)chunk->data;
+
+			PcodeScript &src = memHandle.scripts.emplace_back();
+			src.handle = handle;
+			src.name = "master script";
+			src.disassembled = false;
+		}
 
-			if (chunk.type == ChunkType::CHUNK_PROCESSES)
+		if (const Chunk *chunk = memHandle.find_chunk(ChunkType::CHUNK_PROCESSES))
+		{
+			Reader data { chunk->data, chunk->size - 8 };
+			for (u32 i = 0; i < gameVars.numGlobalProcesses; ++i)
 			{
-				istringstream data { { (char*)chunk.data, chunk.size } };
-				for (u32 i = 0; i < gameVars.numGlobalProcesses; ++i)
-				{
-					u32 pid = read_u32(data);
-					u32 handle = read_u32(data);
+				u32 pid = read_u32(data);
+				u32 handle = read_u32(data);
 
-					ostringstream name;
-					name << "global process script " << i << ", pid: "  << hex << setw(4) << right << setfill('0') << pid;
+				ostringstream name;
+				name << "global process script " << i << ", pid: "  << hex << setw(4) << right << setfill('0') << pid;
 
-					PcodeScript &src = memHandle.scripts.emplace_back();
-					src.handle = handle;
-					src.name = name.str();
-					src.disassembly = pcode_disassemble(*get_memory(handle));
-				}
+				PcodeScript &src = memHandle.scripts.emplace_back();
+				src.handle = handle;
+				src.name = name.str();
+				src.disassembled = false;
 			}
 		}
 	}
@@ -719,7 +1934,7 @@ void Tinsel::load_processes(u32 i)
 				PcodeScript &src = memHandle.scripts.emplace_back();
 				src.handle = object.hScript;
 				src.name = name.str();
-				src.disassembly = pcode_disassemble(*get_memory(object.hScript));
+				src.disassembled = false;
 		}
 	}
 
@@ -733,7 +1948,7 @@ void Tinsel::load_processes(u32 i)
 			PcodeScript &src = memHandle.scripts.emplace_back();
 			src.handle = memHandle.scene.hSceneScript;
 			src.name = name.str();
-			src.disassembly = pcode_disassemble(*get_memory(memHandle.scene.hSceneScript));
+			src.disassembled = false;
 		}
 
 		if (memHandle.scene.numProcess > 0)
@@ -741,8 +1956,8 @@ void Tinsel::load_processes(u32 i)
 			auto data = get_memory(memHandle.scene.hProcess);
 			for (u32 i = 0; i < memHandle.scene.numProcess; ++i)
 			{
-				u32 pid = read_u32(*data);
-				u32 handle = read_u32(*data);
+				u32 pid = read_u32(data);
+				u32 handle = read_u32(data);
 
 				ostringstream name;
 				name << "scene process script " << i << ", pid: "  << hex << setw(4) << right << setfill('0') << pid;
@@ -750,7 +1965,7 @@ void Tinsel::load_processes(u32 i)
 				PcodeScript &src = memHandle.scripts.emplace_back();
 				src.handle = handle;
 				src.name = name.str();
-				src.disassembly = pcode_disassemble(*get_memory(handle));
+				src.disassembled = false;
 			}
 		}
 
@@ -764,7 +1979,7 @@ void Tinsel::load_processes(u32 i)
 				PcodeScript &src = memHandle.scripts.emplace_back();
 				src.handle = ent.hScript;
 				src.name = name.str();
-				src.disassembly = pcode_disassemble(*get_memory(ent.hScript));
+				src.disassembled = false;
 			}
 		}
 
@@ -778,7 +1993,7 @@ void Tinsel::load_processes(u32 i)
 				PcodeScript &src = memHandle.scripts.emplace_back();
 				src.handle = poly.hScript;
 				src.name = name.str();
-				src.disassembly = pcode_disassemble(*get_memory(poly.hScript));
+				src.disassembled = false;
 			}
 		}
 
@@ -792,12 +2007,27 @@ void Tinsel::load_processes(u32 i)
 				PcodeScript &src = memHandle.scripts.emplace_back();
 				src.handle = actor.hActorCode;
 				src.name = name.str();
-				src.disassembly = pcode_disassemble(*get_memory(actor.hActorCode));
+				src.disassembled = false;
 			}
 		}
 	}
 }
 
+// Disassembles a script found by load_processes the first time it is
+// asked for, i is the MemHandle whose scripts hold it.
+const pmr::vector<PcodeScriptLine>& Tinsel::disassemble_script(u32 i, PcodeScript &script)
+{
+	MemHandle &memHandle = memHandles[i];
+	lock_guard<mutex> lock { memHandle.loadMutex };
+	if (!script.disassembled)
+	{
+		script.disassembly = pcode_disassemble(get_memory(script.handle), &memHandle.arena);
+		script.disassembled = true;
+		measure_memory(i);
+	}
+	return script.disassembly;
+}
+
 void get_rgb(u16 color, u8& r, u8& g, u8& b)
 {
 	r = ((color >> 11) & 0x1F) << 3;
@@ -818,12 +2048,12 @@ vector<u8> Tinsel::decode_image(Image &image) {
 			int width = image.width;
 			int x = 0;
 			while (x < width) {
-				int numPixels = read_u16(*src);
+				int numPixels = read_u16(src);
 
 				if (numPixels & 0x8000)
 				{
 					numPixels &= 0x7FFF;
-					u16 color = read_u16(*src);
+					u16 color = read_u16(src);
 					u8 r,g,b;
 					get_rgb(color, r, g, b);
 					for (int xp = 0; xp < numPixels; ++xp, ++x)
@@ -838,7 +2068,7 @@ vector<u8> Tinsel::decode_image(Image &image) {
 				{
 					for (int xp = 0; xp < numPixels; ++xp, ++x)
 					{
-						u16 color = read_u16(*src);
+						u16 color = read_u16(src);
 						u8 r,g,b;
 						get_rgb(color, r, g, b);
 						*(dst++) = r;
@@ -856,7 +2086,7 @@ vector<u8> Tinsel::decode_image(Image &image) {
 		{
 			for (int x = 0; x < image.width; ++x)
 			{
-				u16 color = read_u16(*src);
+				u16 color = read_u16(src);
 				u8 r,g,b;
 				get_rgb(color, r, g, b);
 
@@ -877,13 +2107,7 @@ Image Tinsel::parse_image(u32 handle)
 	Image i {};
 	i.handle = handle;
 
-	i.width = read_u16(*data);
-	i.height = read_u16(*data);
-	i.aniOffX = read_u16(*data);
-	i.aniOffY = read_u16(*data);
-	i.hImgBits = read_u32(*data);
-	i.isRLE = read_u16(*data);
-	i.colorFlags = read_u16(*data);
+	read_record(data, i);
 
 	return i;
 }
@@ -897,8 +2121,8 @@ Frames Tinsel::parse_frame(u32 handle)
 
 	while(true)
 	{
-		u32 pFrame = read_u32(*data);
-		if (pFrame == 0 || ((pFrame >> 25) >= memHandles.size()))
+		u32 pFrame = read_u32(data);
+		if (pFrame == 0 || !is_valid(pFrame))
 		{
 			break;
 		}
@@ -915,13 +2139,7 @@ MultiInit Tinsel::parse_multi_init(u32 handle)
 
 	MultiInit mi {};
 	mi.handle = handle;
-	mi.hMulFrame = read_u32(*data);
-	mi.mulFlags = read_i32(*data);
-	mi.mulID = read_i32(*data);
-	mi.mulX = read_i32(*data);
-	mi.mulY = read_i32(*data);
-	mi.mulZ = read_i32(*data);
-	mi.otherFlags = read_u32(*data);
+	read_record<MultiInitRecord>(data, mi);
 
 	if (mi.hMulFrame != 0)
 	{
@@ -936,7 +2154,7 @@ AnimScript Tinsel::parse_anim_script(u32 handle, bool sound)
 
 	AnimScript animScript {};
 	animScript.handle = handle;
-	animScript.lines = animscript_disassemble(*data);
+	animScript.lines = animscript_disassemble(data);
 
 	for (auto& line : animScript.lines)
 	{
@@ -950,20 +2168,21 @@ AnimScript Tinsel::parse_anim_script(u32 handle, bool sound)
 
 Film Tinsel::parse_film(u32 handle)
 {
+	record_access(AccessKind::Film, handle);
 	auto data = get_memory(handle);
 
 	Film film {};
 	film.handle = handle;
-	film.framerate = read_u32(*data);
-	u32 numreels = read_u32(*data);
+	film.framerate = read_u32(data);
+	u32 numreels = read_u32(data);
 	film.reels.reserve(numreels);
 
 	for (u32 i = 0; i < numreels; ++i)
 	{
 		Reel reel {};
 		reel.handle = i;
-		reel.mobj = read_u32(*data);
-		reel.script = read_u32(*data);
+		reel.mobj = read_u32(data);
+		reel.script = read_u32(data);
 
 		reel.obj = parse_multi_init(reel.mobj);
 		reel.animScript = parse_anim_script(reel.script, reel.obj.mulID == -2);
@@ -986,11 +2205,19 @@ void Tinsel::load_strings()
 	memHandle.size = size;
 	memHandle.flags = 0;
 	memHandle.loaded = true;
-	memHandle.data.resize(size);
+	memHandle.loading = false;
+	memHandle.pinned = false;
+	memHandle.lastUsed = 0;
+	memHandle.memory = {};
+	memHandle.buffer.resize(size);
+	memHandle.data = memHandle.buffer.data();
+	memHandle.decoded = size;
+	memHandle.ready = true;
 
-	input.read((char*)memHandle.data.data(), size);
+	input.read((char*)memHandle.buffer.data(), size);
 
 	load_chunks(memHandle.id);
+	measure_memory(memHandle.id);
 
 	stringsId = memHandle.id;
 }
@@ -998,7 +2225,7 @@ void Tinsel::load_strings()
 string Tinsel::get_string(u32 id)
 {
 	MemHandle &memHandle = memHandles[stringsId];
-	u8* data = memHandle.data.data();
+	const u8* data = memHandle.data;
 
 	u32 chunkSkip = id / 64;
 	u32 strSkip = id % 64;
@@ -1072,3 +2299,605 @@ string Tinsel::get_string(u32 id)
 	}
 	return string ((char*)(data + 1), len);
 }
+
+// Fonts in the loaded handles: CHUNK_FONT chunks and the operands of
+// OP_FONT in the scripts disassembled so far.
+vector<u32> Tinsel::find_fonts()
+{
+	vector<u32> fonts;
+	for (auto& memHandle : memHandles)
+	{
+		lock_guard<mutex> lock { memHandle.loadMutex };
+		for (auto& chunk : memHandle.chunks_of(ChunkType::CHUNK_FONT))
+		{
+			fonts.push_back(Handle(memHandle.id, chunk.pos + 8).value);
+		}
+		for (auto& script : memHandle.scripts)
+		{
+			if (!script.disassembled)
+			{
+				continue;
+			}
+			for (auto& line : script.disassembly)
+			{
+				if (line.opcode == OP_FONT && line.hasArgument && is_valid(line.argument))
+				{
+					fonts.push_back(line.argument);
+				}
+			}
+		}
+	}
+	sort(fonts.begin(), fonts.end());
+	fonts.erase(unique(fonts.begin(), fonts.end()), fonts.end());
+	return fonts;
+}
+
+// Decodes every character image of a font once and packs them into rows
+// of the atlas. Characters sharing an image share its glyph.
+const GlyphAtlas& Tinsel::font_atlas(u32 hFont)
+{
+	static const u32 kAtlasWidth = 512;
+
+	auto found = fontAtlases.find(hFont);
+	if (found != fontAtlases.end())
+	{
+		return found->second;
+	}
+
+	GlyphAtlas &atlas = fontAtlases[hFont];
+	atlas.font.handle = hFont;
+	atlas.glyphs = {};
+	atlas.lineHeight = 0;
+
+	auto data = get_memory(hFont);
+	read_record(data, atlas.font);
+	array<u32, kFontChars> hImages;
+	for (auto& hImage : hImages)
+	{
+		hImage = read_u32(data);
+	}
+
+	vector<Image> images;
+	map<u32, u32> imageIndex;
+	array<u32, kFontChars> glyphImage;
+	glyphImage.fill(0xFFFFFFFF);
+	u32 widest = 0;
+	for (u32 c = 0; c < kFontChars; ++c)
+	{
+		if (hImages[c] == 0 || !is_valid(hImages[c]))
+		{
+			continue;
+		}
+		auto placed = imageIndex.find(hImages[c]);
+		if (placed == imageIndex.end())
+		{
+			Image image = parse_image(hImages[c]);
+			if (image.width == 0 || image.height == 0)
+			{
+				continue;
+			}
+			placed = imageIndex.emplace(hImages[c], images.size()).first;
+			images.push_back(image);
+			widest = max<u32>(widest, image.width);
+		}
+		glyphImage[c] = placed->second;
+	}
+
+	// shelf packing in image order, rows as tall as their tallest image
+	atlas.width = max(kAtlasWidth, widest);
+	vector<Glyph> placement(images.size());
+	u32 x = 0;
+	u32 y = 0;
+	u32 rowHeight = 0;
+	for (u32 k = 0; k < images.size(); ++k)
+	{
+		const Image &image = images[k];
+		if (x + image.width > atlas.width)
+		{
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+		placement[k] = { (u16)x, (u16)y, image.width, image.height, (i16)image.aniOffX, (i16)image.aniOffY };
+		x += image.width;
+		rowHeight = max<u32>(rowHeight, image.height);
+		atlas.lineHeight = max<u32>(atlas.lineHeight, image.height);
+	}
+	atlas.height = y + rowHeight;
+
+	atlas.pixels.assign((size_t)atlas.width * atlas.height * 4, 0);
+	for (u32 k = 0; k < images.size(); ++k)
+	{
+		vector<u8> pixels = decode_image(images[k]);
+		const Glyph &glyph = placement[k];
+		for (u32 row = 0; row < glyph.height; ++row)
+		{
+			const u8 *src = pixels.data() + (size_t)row * glyph.width * 4;
+			u8 *dst = atlas.pixels.data() + ((size_t)(glyph.y + row) * atlas.width + glyph.x) * 4;
+			for (u32 col = 0; col < glyph.width; ++col, src += 4, dst += 4)
+			{
+				dst[0] = src[0];
+				dst[1] = src[1];
+				dst[2] = src[2];
+				dst[3] = (src[0] | src[1] | src[2]) != 0 ? 0xFF : 0;
+			}
+		}
+	}
+
+	for (u32 c = 0; c < kFontChars; ++c)
+	{
+		if (glyphImage[c] != 0xFFFFFFFF)
+		{
+			atlas.glyphs[c] = placement[glyphImage[c]];
+		}
+	}
+	return atlas;
+}
+
+// Greedy word wrap at maxWidth, 0 for none. Lines break at spaces and
+// newlines, characters the font has no image for are skipped.
+TextLayout Tinsel::layout_text(const GlyphAtlas &atlas, string_view text, u32 maxWidth)
+{
+	const FontRecord &font = atlas.font;
+	i32 lineStep = font.ySpacing > 0 ? font.ySpacing : (i32)atlas.lineHeight;
+	i32 spaceStep = font.spaceSize > 0 ? font.spaceSize : (i32)atlas.lineHeight / 3;
+	auto advance = [&](u8 c)
+	{
+		const Glyph &glyph = atlas.glyphs[c];
+		return glyph.width != 0 ? glyph.width + font.xSpacing : 0;
+	};
+
+	TextLayout layout;
+	layout.font = font.handle;
+	layout.width = 0;
+	layout.height = text.empty() ? 0 : lineStep;
+
+	i32 x = 0;
+	i32 y = 0;
+	size_t pos = 0;
+	while (pos < text.size())
+	{
+		if (text[pos] == '\n')
+		{
+			x = 0;
+			y += lineStep;
+			++pos;
+			continue;
+		}
+		if (text[pos] == ' ')
+		{
+			x += spaceStep;
+			++pos;
+			continue;
+		}
+
+		size_t end = pos;
+		i32 wordWidth = 0;
+		while (end < text.size() && text[end] != ' ' && text[end] != '\n')
+		{
+			wordWidth += advance(text[end]);
+			++end;
+		}
+		if (maxWidth != 0 && x > 0 && x + wordWidth > (i32)maxWidth)
+		{
+			x = 0;
+			y += lineStep;
+		}
+
+		for (; pos < end; ++pos)
+		{
+			u8 c = text[pos];
+			const Glyph &glyph = atlas.glyphs[c];
+			if (glyph.width != 0)
+			{
+				layout.quads.push_back({ x - glyph.offX, y - glyph.offY, c });
+				layout.width = max<u32>(layout.width, max(0, x - glyph.offX + glyph.width));
+				layout.height = max<u32>(layout.height, max(0, y - glyph.offY + glyph.height));
+			}
+			x += advance(c);
+		}
+		layout.height = max<u32>(layout.height, y + lineStep);
+	}
+	return layout;
+}
+
+// Lays out a batch of strings with one font, looking the atlas up once.
+vector<TextLayout> Tinsel::layout_strings(u32 hFont, const vector<u32> &ids, u32 maxWidth)
+{
+	const GlyphAtlas &atlas = font_atlas(hFont);
+	vector<TextLayout> layouts;
+	layouts.reserve(ids.size());
+	for (u32 id : ids)
+	{
+		layouts.push_back(layout_text(atlas, get_string(id), maxWidth));
+	}
+	return layouts;
+}
+
+// Compresses the decompressed contents of a handle back into the .scn LZSS
+// format and writes them to path, after checking that they decode back.
+bool Tinsel::repack_memhandle(u32 i, const string &path, u32 effort)
+{
+	MemHandle &memHandle = memHandles[i];
+	if (!open_memhandle(i) || memHandle.fill(memHandle.size) != memHandle.size)
+	{
+		return false;
+	}
+
+	vector<u8> compressed = compressLZSS(memHandle.data, memHandle.size, effort, thread::hardware_concurrency());
+
+	vector<u8> check(memHandle.size);
+	int written = decompressLZSS(compressed.data(), compressed.size(), check.data(), check.size(), LzssDecoder::Reference);
+	if (written != (int)memHandle.size || memcmp(check.data(), memHandle.data, memHandle.size) != 0)
+	{
+		return false;
+	}
+
+	ofstream output { path, ios::binary };
+	output.write((const char*)compressed.data(), compressed.size());
+	return (bool)output;
+}
+
+// Decodes every .scn listed in data/list.txt with each decoder, checks that
+// the outputs match and prints throughput in MB/s of decompressed output.
+void Tinsel::benchmark_lzss()
+{
+	static const int kRuns = 5;
+	static const LzssDecoder decoders[] = { LzssDecoder::Reference, LzssDecoder::Bitbuffer, LzssDecoder::Window };
+	static const char *decoderNames[] = { "reference", "bitbuffer", "window" };
+	static const size_t kNumDecoders = sizeof(decoders) / sizeof(decoders[0]);
+
+	ifstream list { "data/list.txt" };
+	string name;
+	double totalSeconds[kNumDecoders] = {};
+	size_t totalBytes = 0;
+
+	printf("%-14s %10s", "file", "size");
+	for (auto decoderName : decoderNames)
+	{
+		printf(" %10s MB/s", decoderName);
+	}
+	printf("\n");
+
+	while (list >> name)
+	{
+		if (name.size() < 4 || name.compare(name.size() - 4, 4, ".scn") != 0)
+		{
+			continue;
+		}
+
+		u32 size = 0;
+		for (auto& memHandle : memHandles)
+		{
+			if (memHandle.name == name)
+			{
+				size = memHandle.size;
+			}
+		}
+
+		MappedFile input;
+		if (size == 0 || !input.open("data/" + name))
+		{
+			printf("%-14s missing\n", name.c_str());
+			continue;
+		}
+
+		vector<u8> outputs[kNumDecoders];
+		double seconds[kNumDecoders] = {};
+		for (size_t d = 0; d < kNumDecoders; ++d)
+		{
+			outputs[d].resize(size);
+			for (int run = 0; run < kRuns; ++run)
+			{
+				auto start = chrono::steady_clock::now();
+				decompressLZSS(input.data, input.size, outputs[d].data(), size, decoders[d]);
+				seconds[d] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			}
+			totalSeconds[d] += seconds[d];
+		}
+		totalBytes += (size_t)size * kRuns;
+
+		printf("%-14s %10u", name.c_str(), size);
+		bool same = true;
+		for (size_t d = 0; d < kNumDecoders; ++d)
+		{
+			printf(" %15.1f", size * kRuns / seconds[d] / 1e6);
+			same = same && outputs[d] == outputs[0];
+		}
+		printf("%s\n", same ? "" : "  MISMATCH");
+	}
+
+	printf("%-14s %10zu", "total", totalBytes / kRuns);
+	for (size_t d = 0; d < kNumDecoders; ++d)
+	{
+		printf(" %15.1f", totalBytes / totalSeconds[d] / 1e6);
+	}
+	printf("\n");
+}
+
+bool Tinsel::save_stats_csv(const string &path)
+{
+	ofstream output { path };
+	if (!output.is_open())
+	{
+		return false;
+	}
+
+	output << "name,input,output,seconds,read_seconds,literals,matches";
+	for (u32 i = 0; i < 16; ++i)
+	{
+		output << ",len" << i + 2;
+	}
+	for (u32 i = 0; i < 13; ++i)
+	{
+		output << ",dist" << (1 << i);
+	}
+	output << "\n";
+
+	for (auto& memHandle : memHandles)
+	{
+		const LzssStats &stats = memHandle.stats;
+		if (stats.outputBytes == 0)
+		{
+			continue;
+		}
+		output << memHandle.name << "," << stats.inputBytes << "," << stats.outputBytes
+			<< "," << stats.seconds << "," << stats.readSeconds << "," << stats.literals << "," << stats.matches;
+		for (auto count : stats.lengths)
+		{
+			output << "," << count;
+		}
+		for (auto count : stats.distances)
+		{
+			output << "," << count;
+		}
+		output << "\n";
+	}
+	return (bool)output;
+}
+
+template<typename R, typename V>
+static bool save_csv(const string &path, const V &records)
+{
+	if (records.empty())
+	{
+		return true;
+	}
+	ofstream output { path };
+	if (!output.is_open())
+	{
+		return false;
+	}
+	write_csv_header<R>(output);
+	for (auto& record : records)
+	{
+		write_csv_row(output, record);
+	}
+	return (bool)output;
+}
+
+// One CSV per kind of record the handle holds, named prefix.<kind>.csv.
+bool Tinsel::save_records_csv(u32 i, const string &prefix)
+{
+	const MemHandle &memHandle = memHandles[i];
+	bool ok = true;
+	if (memHandle.hasScene)
+	{
+		const Scene &scene = memHandle.scene;
+		ok &= save_csv<SceneRecord>(prefix + ".scene.csv", vector<SceneRecord> { scene });
+		ok &= save_csv<Entrance>(prefix + ".entrances.csv", scene.entrances);
+		ok &= save_csv<Poly>(prefix + ".polys.csv", scene.polys);
+		ok &= save_csv<Actor>(prefix + ".actors.csv", scene.actors);
+	}
+	if (memHandle.hasObjects)
+	{
+		ok &= save_csv<Object>(prefix + ".objects.csv", memHandle.objects);
+	}
+	return ok;
+}
+
+template<typename R, typename V>
+static void write_json_array(ostream &output, const char *key, const V &records)
+{
+	output << ",\n\"" << key << "\":[";
+	bool first = true;
+	for (auto& record : records)
+	{
+		output << (first ? "\n" : ",\n");
+		write_json<R>(output, record);
+		first = false;
+	}
+	output << "]";
+}
+
+bool Tinsel::save_records_json(u32 i, const string &path)
+{
+	const MemHandle &memHandle = memHandles[i];
+	ofstream output { path };
+	if (!output.is_open())
+	{
+		return false;
+	}
+	output << "{\"name\":\"" << memHandle.name << "\"";
+	if (memHandle.hasScene)
+	{
+		const Scene &scene = memHandle.scene;
+		output << ",\n\"scene\":";
+		write_json<SceneRecord>(output, scene);
+		write_json_array<Entrance>(output, "entrances", scene.entrances);
+		write_json_array<Poly>(output, "polys", scene.polys);
+		write_json_array<Actor>(output, "actors", scene.actors);
+	}
+	if (memHandle.hasObjects)
+	{
+		write_json_array<Object>(output, "objects", memHandle.objects);
+	}
+	output << "}\n";
+	return (bool)output;
+}
+
+void Tinsel::start_trace()
+{
+	lock_guard<mutex> lock { traceMutex };
+	trace.clear();
+	traceStart = chrono::steady_clock::now();
+	traceAccess = true;
+}
+
+void Tinsel::record_access(AccessKind kind, Handle h)
+{
+	if (!traceAccess.load(memory_order_relaxed) || traceSuspended)
+	{
+		return;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - traceStart).count();
+	lock_guard<mutex> lock { traceMutex };
+	trace.push_back({ kind, h, seconds });
+}
+
+bool Tinsel::save_trace_csv(const string &path)
+{
+	ofstream output { path };
+	if (!output.is_open())
+	{
+		return false;
+	}
+
+	static const char *kindNames[] = { "memory", "load", "film" };
+	lock_guard<mutex> lock { traceMutex };
+	output << "seconds,kind,handle,name,offset\n";
+	for (auto& event : trace)
+	{
+		output << event.seconds << "," << kindNames[(u32)event.kind] << ","
+			<< hex << setw(8) << setfill('0') << event.handle.value << dec << ",";
+		if (event.handle.index() < memHandles.size())
+		{
+			output << memHandles[event.handle.index()].name;
+		}
+		output << "," << event.handle.offset() << "\n";
+	}
+	output.flush();
+	return (bool)output;
+}
+
+// The plan is one line per MemHandle name, most likely first:
+//   sessions <n>
+//   <name> <sessions touched> <mean rank of first touch>
+// Saving folds this session's trace into the existing file.
+struct PlanEntry
+{
+	string name;
+	u32 sessions;
+	double rank;
+};
+
+static u32 read_plan(const string &path, vector<PlanEntry> &entries)
+{
+	ifstream input { path };
+	string word;
+	u32 sessions = 0;
+	if (!(input >> word >> sessions) || word != "sessions")
+	{
+		return 0;
+	}
+	PlanEntry entry;
+	while (input >> entry.name >> entry.sessions >> entry.rank)
+	{
+		entries.push_back(entry);
+	}
+	return sessions;
+}
+
+bool Tinsel::save_preload_plan(const string &path)
+{
+	vector<PlanEntry> entries;
+	u32 sessions = read_plan(path, entries);
+
+	// Handles in the order this session first touched them.
+	vector<u32> order;
+	{
+		lock_guard<mutex> lock { traceMutex };
+		vector<bool> seen(memHandles.size(), false);
+		for (auto& event : trace)
+		{
+			u32 index = event.handle.index();
+			if (index < memHandles.size() && index != stringsId && !seen[index])
+			{
+				seen[index] = true;
+				order.push_back(index);
+			}
+		}
+	}
+
+	for (u32 rank = 0; rank < order.size(); ++rank)
+	{
+		string name { memHandles[order[rank]].name };
+		auto it = find_if(entries.begin(), entries.end(), [&](const PlanEntry &e) { return e.name == name; });
+		if (it == entries.end())
+		{
+			entries.push_back({ name, 1, (double)rank });
+		}
+		else
+		{
+			it->rank = (it->rank * it->sessions + rank) / (it->sessions + 1);
+			it->sessions++;
+		}
+	}
+	sessions++;
+
+	stable_sort(entries.begin(), entries.end(), [](const PlanEntry &a, const PlanEntry &b) {
+		if (a.sessions != b.sessions)
+		{
+			return a.sessions > b.sessions;
+		}
+		return a.rank < b.rank;
+	});
+
+	ofstream output { path + ".tmp" };
+	output << "sessions " << sessions << "\n";
+	for (auto& entry : entries)
+	{
+		output << entry.name << " " << entry.sessions << " " << entry.rank << "\n";
+	}
+	output.close();
+	error_code error;
+	if (output)
+	{
+		filesystem::rename(path + ".tmp", path, error);
+	}
+	if (!output || error)
+	{
+		filesystem::remove(path + ".tmp", error);
+		return false;
+	}
+	return true;
+}
+
+// Queues the handles of a saved plan as background loads in plan order,
+// returns how many were queued.
+u32 Tinsel::load_preload_plan(const string &path)
+{
+	vector<PlanEntry> entries;
+	if (read_plan(path, entries) == 0)
+	{
+		return 0;
+	}
+
+	map<string_view, u32> byName;
+	for (auto& memHandle : memHandles)
+	{
+		byName[memHandle.name] = memHandle.id;
+	}
+
+	u32 queued = 0;
+	for (auto& entry : entries)
+	{
+		auto it = byName.find(entry.name);
+		if (it != byName.end() && memHandles[it->second].data == nullptr && !memHandles[it->second].loaded)
+		{
+			load_memhandle_async(it->second, true);
+			queued++;
+		}
+	}
+	return queued;
+}
@@ -2,16 +2,29 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <cstring>
 #include <iostream>
 #include <vector>
+#include <array>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <atomic>
+#include <memory_resource>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 
 #include "base.hpp"
 #include "read.hpp"
+#include "lzss.hpp"
+#include "mapped_file.hpp"
+#include "worker_pool.hpp"
+#include "schema.hpp"
 
 using namespace std;
 
-int decompressLZSS(string &filename, u8 *output);
 
 enum class ChunkType : u32
 {
@@ -59,9 +72,77 @@ struct Chunk
 	u32 pos;
 	u32 size;
 
-	u8* data;
+	const u8* data;
 };
 
+// Chunk types are 0x3334xxxx with small low words, so they index a flat
+// table directly. GRAB_NAME gets the slot after the numbered types and
+// anything unknown shares the last one.
+static const u32 kChunkSlots = 0x42;
+
+static constexpr u32 chunk_slot(ChunkType type)
+{
+	u32 value = (u32)type;
+	if ((value >> 16) != 0x3334)
+	{
+		return kChunkSlots - 1;
+	}
+	value &= 0xffff;
+	if (value < 0x40)
+	{
+		return value;
+	}
+	return value == 0x100 ? 0x40 : kChunkSlots - 1;
+}
+static_assert(chunk_slot(ChunkType::CHUNK_GAME) == 0x31 && chunk_slot(ChunkType::CHUNK_GRAB_NAME) == 0x40, "chunk slots");
+
+// Chunks of one type in file order, see MemHandle::chunks_of.
+struct ChunkRange
+{
+	const Chunk *chunks;
+	const u32 *first;
+	const u32 *last;
+
+	struct iterator
+	{
+		const Chunk *chunks;
+		const u32 *at;
+
+		const Chunk& operator*() const { return chunks[*at]; }
+		iterator& operator++() { ++at; return *this; }
+		bool operator!=(const iterator &other) const { return at != other.at; }
+	};
+
+	iterator begin() const { return { chunks, first }; }
+	iterator end() const { return { chunks, last }; }
+	bool empty() const { return first == last; }
+	size_t size() const { return last - first; }
+};
+
+// Reference into scene data as stored in the files: the top 7 bits select
+// a MemHandle, the low 25 bits are a byte offset into its decompressed
+// data. Converts from the raw u32 so record fields can be passed directly.
+struct Handle
+{
+	static constexpr u32 kIndexShift = 25;
+	static constexpr u32 kOffsetMask = 0x01ffffff;
+
+	u32 value;
+
+	constexpr Handle() : value { 0 } {}
+	constexpr Handle(u32 value_) : value { value_ } {}
+	constexpr Handle(u32 index, u32 offset) : value { (index << kIndexShift) | (offset & kOffsetMask) } {}
+
+	constexpr u32 index() const { return value >> kIndexShift; }
+	constexpr u32 offset() const { return value & kOffsetMask; }
+
+	constexpr explicit operator bool() const { return value != 0; }
+	constexpr bool operator==(Handle other) const { return value == other.value; }
+	constexpr bool operator!=(Handle other) const { return value != other.value; }
+};
+static_assert(Handle(3, 0x1234).index() == 3 && Handle(3, 0x1234).offset() == 0x1234, "handle layout");
+static_assert(Handle(0x7f, 0).value == 0xfe000000, "handle layout");
+
 enum class MemHandleFlags
 {
 	Preload		= 0x01000000L,	///< preload memory
@@ -72,6 +153,24 @@ enum class MemHandleFlags
 	Loaded		= 0x20000000L
 };
 
+// One entry of data/index exactly as stored on disk, fields are little
+// endian like the host. The index is mapped and used in place.
+#pragma pack(push, 1)
+struct IndexRecord
+{
+	char name[12];	///< NUL padded, not terminated when 12 long
+	u32 size;
+	u32 unused;
+	u32 flags;
+
+	string_view name_view() const
+	{
+		return { name, strnlen(name, sizeof(name)) };
+	}
+};
+#pragma pack(pop)
+static_assert(sizeof(IndexRecord) == 24, "index records are 24 bytes");
+
 struct GameVariables
 {
 	u32	un0;
@@ -104,6 +203,23 @@ struct Image
 	u16 colorFlags;
 };
 
+template<> struct Schema<Image>
+{
+	static constexpr const char *name = "Image";
+	static constexpr u32 size = 16;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(Image, width, 0, Dec),
+		SCHEMA_FIELD(Image, height, 2, Dec),
+		SCHEMA_FIELD(Image, aniOffX, 4, Dec),
+		SCHEMA_FIELD(Image, aniOffY, 6, Dec),
+		SCHEMA_FIELD(Image, hImgBits, 8, Hex),
+		SCHEMA_FIELD(Image, isRLE, 12, Dec),
+		SCHEMA_FIELD(Image, colorFlags, 14, Hex),
+	};
+};
+static_assert(schema_valid<Image>(), "Image layout");
+
 struct Frames
 {
 	u32 handle;
@@ -146,9 +262,11 @@ struct AnimScript
 	vector<AnimScriptLine> lines;
 };
 
-static vector<AnimScriptLine> animscript_disassemble(istream &code);
+static vector<AnimScriptLine> animscript_disassemble(Reader code);
 
-struct MultiInit
+// The on-disk part is split out of MultiInit and Scene, which own
+// containers and so are not standard layout themselves.
+struct MultiInitRecord
 {
 	u32 handle;
 
@@ -159,7 +277,27 @@ struct MultiInit
 	i32 mulY;
 	i32 mulZ;
 	u32 otherFlags;
+};
+
+template<> struct Schema<MultiInitRecord>
+{
+	static constexpr const char *name = "MultiInit";
+	static constexpr u32 size = 28;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(MultiInitRecord, hMulFrame, 0, Hex),
+		SCHEMA_FIELD(MultiInitRecord, mulFlags, 4, Hex),
+		SCHEMA_FIELD(MultiInitRecord, mulID, 8, Hex),
+		SCHEMA_FIELD(MultiInitRecord, mulX, 12, Dec),
+		SCHEMA_FIELD(MultiInitRecord, mulY, 16, Dec),
+		SCHEMA_FIELD(MultiInitRecord, mulZ, 20, Dec),
+		SCHEMA_FIELD(MultiInitRecord, otherFlags, 24, Hex),
+	};
+};
+static_assert(schema_valid<MultiInitRecord>(), "MultiInit layout");
 
+struct MultiInit : MultiInitRecord
+{
 	Frames frames;
 };
 
@@ -192,6 +330,20 @@ struct Entrance
 	u32 flags;
 };
 
+template<> struct Schema<Entrance>
+{
+	static constexpr const char *name = "Entrance";
+	static constexpr u32 size = 16;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(Entrance, eNumber, 0, Dec),
+		SCHEMA_FIELD(Entrance, hScript, 4, Hex),
+		SCHEMA_FIELD(Entrance, hEntDesc, 8, Hex),
+		SCHEMA_FIELD(Entrance, flags, 12, Hex),
+	};
+};
+static_assert(schema_valid<Entrance>(), "Entrance layout");
+
 struct Camera
 {
 	u32 handle;
@@ -238,6 +390,44 @@ struct Poly
 	u32 hScript;
 };
 
+template<> struct Schema<Poly>
+{
+	static constexpr const char *name = "Poly";
+	static constexpr u32 size = 136;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(Poly, type, 0, Dec),
+		SCHEMA_FIELD(Poly, x, 4, Dec),
+		SCHEMA_FIELD(Poly, y, 20, Dec),
+		SCHEMA_FIELD(Poly, xOff, 36, Dec),
+		SCHEMA_FIELD(Poly, yOff, 40, Dec),
+		SCHEMA_FIELD(Poly, id, 44, Hex),
+		SCHEMA_FIELD(Poly, _ws, 48, Dec),
+		SCHEMA_FIELD(Poly, field, 52, Dec),
+		SCHEMA_FIELD(Poly, reftype, 56, Dec),
+		SCHEMA_FIELD(Poly, tagx, 60, Dec),
+		SCHEMA_FIELD(Poly, tagy, 64, Dec),
+		SCHEMA_FIELD(Poly, hTagText, 68, Hex),
+		SCHEMA_FIELD(Poly, nodeX, 72, Dec),
+		SCHEMA_FIELD(Poly, nodeY, 76, Dec),
+		SCHEMA_FIELD(Poly, hFilm, 80, Hex),
+		SCHEMA_FIELD(Poly, scale1, 84, Dec),
+		SCHEMA_FIELD(Poly, scale2, 88, Dec),
+		SCHEMA_FIELD(Poly, level1, 92, Dec),
+		SCHEMA_FIELD(Poly, level2, 96, Dec),
+		SCHEMA_FIELD(Poly, bright1, 100, Dec),
+		SCHEMA_FIELD(Poly, bright2, 104, Dec),
+		SCHEMA_FIELD(Poly, reelType, 108, Dec),
+		SCHEMA_FIELD(Poly, zFactor, 112, Dec),
+		SCHEMA_FIELD(Poly, nodeCount, 116, Dec),
+		SCHEMA_FIELD(Poly, nodeListX, 120, Hex),
+		SCHEMA_FIELD(Poly, nodeListY, 124, Hex),
+		SCHEMA_FIELD(Poly, lineList, 128, Hex),
+		SCHEMA_FIELD(Poly, hScript, 132, Hex),
+	};
+};
+static_assert(schema_valid<Poly>(), "Poly layout");
+
 struct Actor
 {
 	u32 handle;
@@ -251,7 +441,24 @@ struct Actor
 	u32 hOverrideTag;
 };
 
-struct Scene
+template<> struct Schema<Actor>
+{
+	static constexpr const char *name = "Actor";
+	static constexpr u32 size = 28;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(Actor, id, 0, Hex),
+		SCHEMA_FIELD(Actor, hTagText, 4, Hex),
+		SCHEMA_FIELD(Actor, tagPortionV, 8, Dec),
+		SCHEMA_FIELD(Actor, tagPortionH, 12, Dec),
+		SCHEMA_FIELD(Actor, hActorCode, 16, Hex),
+		SCHEMA_FIELD(Actor, tagFlags, 20, Hex),
+		SCHEMA_FIELD(Actor, hOverrideTag, 24, Hex),
+	};
+};
+static_assert(schema_valid<Actor>(), "Actor layout");
+
+struct SceneRecord
 {
 	u32 handle;
 
@@ -272,10 +479,42 @@ struct Scene
 	u32 hProcess;
 	u32 hMusicScript;
 	u32 hMusicSegment;
+};
+
+template<> struct Schema<SceneRecord>
+{
+	static constexpr const char *name = "Scene";
+	static constexpr u32 size = 68;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(SceneRecord, defRefer, 0, Dec),
+		SCHEMA_FIELD(SceneRecord, hSceneScript, 4, Hex),
+		SCHEMA_FIELD(SceneRecord, hSceneDesc, 8, Hex),
+		SCHEMA_FIELD(SceneRecord, numEntrance, 12, Dec),
+		SCHEMA_FIELD(SceneRecord, hEntrance, 16, Hex),
+		SCHEMA_FIELD(SceneRecord, numCameras, 20, Dec),
+		SCHEMA_FIELD(SceneRecord, hCamera, 24, Hex),
+		SCHEMA_FIELD(SceneRecord, numLights, 28, Dec),
+		SCHEMA_FIELD(SceneRecord, hLight, 32, Hex),
+		SCHEMA_FIELD(SceneRecord, numPoly, 36, Dec),
+		SCHEMA_FIELD(SceneRecord, hPoly, 40, Hex),
+		SCHEMA_FIELD(SceneRecord, numTaggedActor, 44, Dec),
+		SCHEMA_FIELD(SceneRecord, hTaggedActor, 48, Hex),
+		SCHEMA_FIELD(SceneRecord, numProcess, 52, Dec),
+		SCHEMA_FIELD(SceneRecord, hProcess, 56, Hex),
+		SCHEMA_FIELD(SceneRecord, hMusicScript, 60, Hex),
+		SCHEMA_FIELD(SceneRecord, hMusicSegment, 64, Hex),
+	};
+};
+static_assert(schema_valid<SceneRecord>(), "Scene layout");
+
+struct Scene : SceneRecord
+{
+	pmr::vector<Entrance> entrances;
+	pmr::vector<Poly> polys;
+	pmr::vector<Actor> actors;
 
-	vector<Entrance> entrances;
-	vector<Poly> polys;
-	vector<Actor> actors;
+	Scene(pmr::memory_resource *resource = pmr::get_default_resource());
 };
 
 struct Object
@@ -290,6 +529,156 @@ struct Object
 	u32 notClue;
 };
 
+template<> struct Schema<Object>
+{
+	static constexpr const char *name = "Object";
+	static constexpr u32 size = 24;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(Object, id, 0, Hex),
+		SCHEMA_FIELD(Object, hIconFilm, 4, Hex),
+		SCHEMA_FIELD(Object, hScript, 8, Hex),
+		SCHEMA_FIELD(Object, attribute, 12, Hex),
+		SCHEMA_FIELD(Object, _u, 16, Hex),
+		SCHEMA_FIELD(Object, notClue, 20, Hex),
+	};
+};
+static_assert(schema_valid<Object>(), "Object layout");
+
+// Font header as found in a CHUNK_FONT chunk or behind an OP_FONT handle.
+// It is followed by kFontChars image handles, one per character code.
+struct FontRecord
+{
+	u32 handle;
+
+	i32 xSpacing;
+	i32 ySpacing;
+	i32 xShadow;
+	i32 yShadow;
+	i32 spaceSize;
+	i32 baseColor;
+	u32 hObjImg;
+	u32 objFlags;
+	i32 objID;
+	i32 objX;
+	i32 objY;
+	i32 objZ;
+};
+
+template<> struct Schema<FontRecord>
+{
+	static constexpr const char *name = "Font";
+	static constexpr u32 size = 48;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(FontRecord, xSpacing, 0, Dec),
+		SCHEMA_FIELD(FontRecord, ySpacing, 4, Dec),
+		SCHEMA_FIELD(FontRecord, xShadow, 8, Dec),
+		SCHEMA_FIELD(FontRecord, yShadow, 12, Dec),
+		SCHEMA_FIELD(FontRecord, spaceSize, 16, Dec),
+		SCHEMA_FIELD(FontRecord, baseColor, 20, Hex),
+		SCHEMA_FIELD(FontRecord, hObjImg, 24, Hex),
+		SCHEMA_FIELD(FontRecord, objFlags, 28, Hex),
+		SCHEMA_FIELD(FontRecord, objID, 32, Hex),
+		SCHEMA_FIELD(FontRecord, objX, 36, Dec),
+		SCHEMA_FIELD(FontRecord, objY, 40, Dec),
+		SCHEMA_FIELD(FontRecord, objZ, 44, Dec),
+	};
+};
+static_assert(schema_valid<FontRecord>(), "Font layout");
+
+static const u32 kFontChars = 300;
+
+// The scene hopper: CHUNK_SCENE_HOPPER lists the scenes that can be hopped
+// to, each with a run of CHUNK_SCENE_HOPPER2 entries for its entrances.
+// Descriptions are string ids.
+struct HopperScene
+{
+	u32 handle;
+
+	u32 hScene;
+	u32 hSceneDesc;
+	u32 numEnt;
+	u32 entIndex;
+};
+
+template<> struct Schema<HopperScene>
+{
+	static constexpr const char *name = "HopperScene";
+	static constexpr u32 size = 16;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(HopperScene, hScene, 0, Hex),
+		SCHEMA_FIELD(HopperScene, hSceneDesc, 4, Hex),
+		SCHEMA_FIELD(HopperScene, numEnt, 8, Dec),
+		SCHEMA_FIELD(HopperScene, entIndex, 12, Dec),
+	};
+};
+static_assert(schema_valid<HopperScene>(), "HopperScene layout");
+
+struct HopperEntry
+{
+	u32 handle;
+
+	u32 eNumber;
+	u32 hDesc;
+	u32 flags;
+};
+
+template<> struct Schema<HopperEntry>
+{
+	static constexpr const char *name = "HopperEntry";
+	static constexpr u32 size = 12;
+	static constexpr Field fields[] =
+	{
+		SCHEMA_FIELD(HopperEntry, eNumber, 0, Dec),
+		SCHEMA_FIELD(HopperEntry, hDesc, 4, Hex),
+		SCHEMA_FIELD(HopperEntry, flags, 8, Hex),
+	};
+};
+static_assert(schema_valid<HopperEntry>(), "HopperEntry layout");
+
+// Where a character's image sits in its font's atlas, width 0 if the font
+// has none. The offsets are the image's animation offsets.
+struct Glyph
+{
+	u16 x;
+	u16 y;
+	u16 width;
+	u16 height;
+	i16 offX;
+	i16 offY;
+};
+
+// Every character image of a font decoded once and packed into a single
+// RGBA bitmap, transparent where the image is black.
+struct GlyphAtlas
+{
+	FontRecord font;
+	u32 width;
+	u32 height;
+	vector<u8> pixels;
+	array<Glyph, kFontChars> glyphs;
+	u32 lineHeight;		///< tallest glyph, used when the font has no ySpacing
+};
+
+// A string laid out with a font: glyph indices and their top left corners,
+// ready to draw from the atlas.
+struct TextLayout
+{
+	struct Quad
+	{
+		i32 x;
+		i32 y;
+		u16 glyph;
+	};
+
+	u32 font;
+	u32 width;
+	u32 height;
+	vector<Quad> quads;
+};
+
 enum PcodeOpCode {
 	OP_NOOP = 0,
 	OP_HALT,
@@ -338,77 +727,323 @@ enum PcodeOpCode {
 	OP_CDFILM
 };
 
+// Scripts and their lines allocate from the arena of the MemHandle that
+// owns them, the allocator is passed down by the containers holding them.
 struct PcodeScriptLine
 {
+	using allocator_type = pmr::polymorphic_allocator<char>;
+
 	u32 ip;
 	u32 opcode;
 	u32 argument;
 	bool hasArgument;
 
-	string opcodeStr;
-	string argumentStr;
-
-	PcodeScriptLine(u32 ip, u32 opcode);
-	PcodeScriptLine(u32 ip, u32 opcode, u32 argument);
-	PcodeScriptLine(u32 ip, string text);
+	pmr::string opcodeStr;
+	pmr::string argumentStr;
+
+	PcodeScriptLine(u32 ip, u32 opcode, const allocator_type &alloc = {});
+	PcodeScriptLine(u32 ip, u32 opcode, u32 argument, const allocator_type &alloc = {});
+	PcodeScriptLine(u32 ip, string_view text, const allocator_type &alloc = {});
+	PcodeScriptLine(const PcodeScriptLine &other, const allocator_type &alloc);
+	PcodeScriptLine(PcodeScriptLine &&other, const allocator_type &alloc);
+	PcodeScriptLine(const PcodeScriptLine &other) = default;
+	PcodeScriptLine(PcodeScriptLine &&other) = default;
+	PcodeScriptLine& operator=(const PcodeScriptLine &other) = default;
+	PcodeScriptLine& operator=(PcodeScriptLine &&other) = default;
 };
 
 struct PcodeScript
 {
+	using allocator_type = pmr::polymorphic_allocator<char>;
+
 	u32 handle;
-	string name;
-	vector <PcodeScriptLine> disassembly;
+	pmr::string name;
+
+	// Filled in on first use by Tinsel::disassemble_script.
+	bool disassembled;
+	pmr::vector<PcodeScriptLine> disassembly;
+
+	PcodeScript(const allocator_type &alloc = {});
+	PcodeScript(const PcodeScript &other, const allocator_type &alloc);
+	PcodeScript(PcodeScript &&other, const allocator_type &alloc);
+	PcodeScript(const PcodeScript &other) = default;
+	PcodeScript(PcodeScript &&other) = default;
+	PcodeScript& operator=(const PcodeScript &other) = default;
+	PcodeScript& operator=(PcodeScript &&other) = default;
+};
+
+static pmr::vector<PcodeScriptLine> pcode_disassemble(Reader code, pmr::memory_resource *resource);
+
+// Bytes a MemHandle keeps alive, by what holds them.
+struct MemoryUsage
+{
+	size_t data;		///< decompressed bytes, on the heap or mapped
+	size_t chunks;
+	size_t scripts;		///< including disassembly lines and their strings
+	size_t scene;		///< entrances, polys and actors
+	size_t objects;
+	size_t slack;		///< arena blocks not held by the above, left by regrowth or unused
+	size_t textures;	///< GL textures the viewer made from its images
+
+	size_t parsed() const
+	{
+		return chunks + scripts + scene + objects + slack;
+	}
+
+	size_t total() const
+	{
+		return data + parsed() + textures;
+	}
+};
+
+// Upstream of a MemHandle's arena. The arena never reuses storage a
+// container gave back, so what it took from here is what parsing costs.
+struct CountingResource : pmr::memory_resource
+{
+	size_t bytes = 0;
+
+	void* do_allocate(size_t size, size_t alignment) override
+	{
+		void *p = pmr::new_delete_resource()->allocate(size, alignment);
+		bytes += size;
+		return p;
+	}
+
+	void do_deallocate(void *p, size_t size, size_t alignment) override
+	{
+		bytes -= size;
+		pmr::new_delete_resource()->deallocate(p, size, alignment);
+	}
+
+	bool do_is_equal(const pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
 };
 
-static vector<PcodeScriptLine> pcode_disassemble(istream &code);
+// Scenes and the ways between them, built by Tinsel::build_scene_graph from
+// the hopper and from the NEWSCENE and HOOKSCENE calls in the scripts of
+// loaded scenes. Edges are in CSR form, the ones leaving node n are
+// edges[edgeStart[n]] up to edges[edgeStart[n + 1]].
+struct SceneGraph
+{
+	static constexpr u32 kNone = 0xFFFFFFFF;
+
+	struct Node
+	{
+		u32 memHandle;
+		u32 hSceneDesc;		///< hopper description, 0 if not in the hopper
+		u32 firstEntrance;	///< run in entrances, sorted by number
+		u32 numEntrances;
+	};
+
+	struct Edge
+	{
+		u32 to;
+		u32 entrance;		///< entrance number in the target scene
+	};
+
+	vector<Node> nodes;
+	vector<HopperEntry> entrances;
+	vector<u32> edgeStart;
+	vector<Edge> edges;
+	u32 hopper;			///< node holding the hopper, kNone without one
+
+	vector<u32> nodeOfMemHandle;
+	unordered_map<string_view, u32> nodeOfName;
+
+	u32 find(string_view name) const;
+	u32 find(Handle hScene) const;
+	const HopperEntry* find_entrance(u32 node, u32 eNumber) const;
+	vector<u32> reachable(u32 from) const;
+	vector<u32> path(u32 from, u32 to) const;
+};
 
-struct MemHandle
+struct MemHandle : ReaderSource
 {
 	u32 id;
-	string name;
+	string_view name;	///< into Tinsel::index, or a literal
 	u32 size;
 	u32 flags;
 
-	bool loaded;
-	vector<u8> data;
-
-
-	vector<Chunk> chunks;
-	vector<PcodeScript> scripts;
+	// Set once decompressed and parsed. loadMutex is held while doing that,
+	// so each handle is loaded by exactly one thread.
+	atomic<bool> loaded;
+	mutex loadMutex;
+
+	bool loading;	///< queued for background decompression
+	bool pinned;	///< in use by the UI, never evicted by trim_memory
+	atomic<u64> lastUsed;	///< Tinsel::useClock at the last access
+
+	// Decompressed contents, points into buffer or into the cache file
+	// mapped from the decompressed cache.
+	const u8 *data;
+	vector<u8> buffer;
+	MappedFile cached;
+
+	// While the file is being decompressed only the first `decoded` bytes
+	// of data are valid, stream holds the decoder state to continue from.
+	// decodeMutex guards opening and decoding. Once `ready` is set, data
+	// and decoded stay fixed until unload and are read without locking.
+	MappedFile source;
+	unique_ptr<LzssStream> stream;
+	u32 decoded;
+	mutex decodeMutex;
+	atomic<bool> ready;
+
+	// Optional checkpoints for decoding small windows out of source.
+	unique_ptr<LzssIndex> checkpoints;
+
+	// Filled in by decompression while Tinsel::collectStats is set.
+	LzssStats stats;
+
+	size_t fill(size_t end) override;
+
+	// Everything parsed from data is allocated from the arena, unloading
+	// releases it in one go. Only used with loadMutex held.
+	CountingResource arenaBlocks;
+	pmr::monotonic_buffer_resource arena;
+
+	pmr::vector<Chunk> chunks;
+	pmr::vector<PcodeScript> scripts;
+
+	// Chunk indices grouped by type, built by load_chunks. The chunks of a
+	// slot are chunkIndex[chunkTypeStart[slot]] up to the next slot's start.
+	array<u32, kChunkSlots + 1> chunkTypeStart;
+	pmr::vector<u32> chunkIndex;
+	bool catalogued;	///< chunks are listed in Tinsel::catalog
 
 	bool hasScene;
 	Scene scene;
 
 	bool hasObjects;
-	vector<Object> objects;
+	pmr::vector<Object> objects;
+
+	// Parsed structures are measured once loaded, data is filled in by
+	// Tinsel::memory_usage and textures by the viewer.
+	MemoryUsage memory;
+
+	MemHandle();
+	void release_parsed();
+
+	ChunkRange chunks_of(ChunkType type) const;
+	const Chunk* find_chunk(ChunkType type) const;
 };
 
 struct Tinsel
 {
 	map<ChunkType, string> chunkTypeNames;
-	vector<MemHandle> memHandles;
+	MappedFile index;
+	deque<MemHandle> memHandles;	///< deque, MemHandles hold mutexes and never move
 	u32 stringsId;
 
 	GameVariables gameVars;
 
+	bool collectStats;
+	bool sharedCache;	///< also use the cross-process cache, see clear_shared_cache
+
+	// Optional list of every chunk of every loaded handle by type, kept up
+	// to date by load_chunks and unload_memhandle once enabled.
+	atomic<bool> chunkCatalog;
+	mutable mutex catalogMutex;
+	map<ChunkType, vector<Handle>> catalog;
+
+	map<u32, GlyphAtlas> fontAtlases;	///< by font handle, built on first use by font_atlas
+	SceneGraph sceneGraph;				///< empty until build_scene_graph
+
+	// Optional record of what was touched and in which order, turned into
+	// a preload plan that a later session warms in the background.
+	enum class AccessKind : u8
+	{
+		Memory,
+		Load,
+		Film
+	};
+	struct AccessEvent
+	{
+		AccessKind kind;
+		Handle handle;
+		double seconds;	///< since tracing started
+	};
+	atomic<bool> traceAccess;		///< only user-initiated accesses are recorded
+	mutex traceMutex;
+	vector<AccessEvent> trace;
+	chrono::steady_clock::time_point traceStart;
+
+	// Decompressed bytes allowed to stay resident, 0 for no limit.
+	// trim_memory evicts least recently used handles above it.
+	size_t memoryBudget;
+	atomic<u64> useClock;
+
+	// Background loading: ioWorkers read compressed files ahead, workers
+	// decompress them into LoadResults, which publish_loaded installs and
+	// parses on the calling thread.
+	struct LoadResult
+	{
+		u32 id = 0;
+		vector<u8> data;
+		u32 decoded = 0;
+		MappedFile cached;
+		LzssStats stats {};
+		bool background = false;	///< prefetch or preload plan, not asked for by the user
+	};
+	mutex loadResultsMutex;
+	vector<LoadResult> loadResults;
+	u32 loadsQueued;	///< loads the user asked for, background ones are not counted
+	u32 loadsDone;
+	unique_ptr<WorkerPool> workers;
+
+	// Compressed bytes read but not yet decoded. The I/O stage waits while
+	// this is above kReadAheadLimit, which bounds the hand-off queue.
+	static const size_t kReadAheadLimit = 64 * 1024 * 1024;
+	mutex readAheadMutex;
+	condition_variable readAheadReady;
+	size_t readAheadBytes;
+	unique_ptr<WorkerPool> ioWorkers; // stopped first by ~Tinsel, it feeds workers
+
 	Tinsel();
+	~Tinsel();
 
 	void load_index();
+	bool open_memhandle(u32 i);
+	bool open_cached(u32 i);
+	void store_cached(u32 i);
+	bool clear_shared_cache();
 	void load_memhandle(u32 i);
+	void load_memhandle_async(u32 i, bool background = false);
+	vector<u32> referenced_memhandles(u32 i) const;
+	void prefetch_referenced(u32 i);
+	void build_scene_graph();
+	u32 publish_loaded(double budgetSeconds);
 	void unload_memhandle(u32 i);
+	bool can_unload(u32 i) const;
+	size_t resident_bytes() const;
+	void measure_memory(u32 i);
+	MemoryUsage memory_usage(u32 i) const;
+	void trim_memory();
 
-	MemHandle* get_memhandle(u32 h);
-	u32 get_offset(u32 h);
-	unique_ptr<istream> get_memory(u32 h);
+	bool is_valid(Handle h) const;
+	MemHandle* get_memhandle(Handle h);
+	Reader get_memory(Handle h);
+	u32 read_window(Handle h, u8 *dst, u32 len);
 
 	void load_chunks(u32 i);
+	void add_to_catalog(MemHandle &memHandle);
+	void enable_chunk_catalog();
+	vector<Handle> find_chunks(ChunkType type) const;
 	void load_game_vars(u32 i);
 	void load_scene(u32 i);
 	void load_objects(u32 i);
 	void load_processes(u32 i);
+	const pmr::vector<PcodeScriptLine>& disassemble_script(u32 i, PcodeScript &script);
 
 	vector<u8> decode_image(Image &image);
 
+	vector<u32> find_fonts();
+	const GlyphAtlas& font_atlas(u32 hFont);
+	TextLayout layout_text(const GlyphAtlas &atlas, string_view text, u32 maxWidth);
+	vector<TextLayout> layout_strings(u32 hFont, const vector<u32> &ids, u32 maxWidth);
+
 	Image parse_image(u32 handle);
 	Frames parse_frame(u32 handle);
 	MultiInit parse_multi_init(u32 handle);
@@ -418,5 +1053,18 @@ struct Tinsel
 
 	void load_strings();
 	string get_string(u32 id);
+
+	bool repack_memhandle(u32 i, const string &path, u32 effort);
+
+	void benchmark_lzss();
+	bool save_stats_csv(const string &path);
+	bool save_records_csv(u32 i, const string &prefix);
+	bool save_records_json(u32 i, const string &path);
+
+	void start_trace();
+	void record_access(AccessKind kind, Handle h);
+	bool save_trace_csv(const string &path);
+	bool save_preload_plan(const string &path);
+	u32 load_preload_plan(const string &path);
 };
 
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <cfloat>
+#include <algorithm>
 
 #include "base.hpp"
 #include "read.hpp"
@@ -15,6 +17,10 @@
 
 #include <fstream>
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
 using namespace std;
 using namespace ImGui;
 
@@ -31,19 +37,125 @@ void TextP(u32 padding, const char* fmt, ...)
 }
 
 Tinsel tinsel;
-map<u32, GLuint> glimages;
+
+struct GlImage
+{
+	GLuint texture;
+	u32 bytes;
+};
+map<u32, GlImage> glimages;
+
+// Texture memory is charged to the MemHandle holding the image.
+void account_texture(u32 handle, i64 bytes)
+{
+	if (tinsel.is_valid(handle))
+	{
+		tinsel.memHandles[Handle(handle).index()].memory.textures += bytes;
+	}
+}
+
+// The memory editor reads handles that are not loaded through read_window,
+// a page at a time, so only the part on screen is decoded.
+struct MemoryWindow
+{
+	u32 index;
+	u32 start;
+	u32 size;
+	u8 bytes[4096];
+};
+
+ImU8 read_memory_window(const ImU8 *data, size_t off)
+{
+	MemoryWindow &window = *(MemoryWindow*)data;
+	if (off < window.start || off >= window.start + window.size)
+	{
+		window.start = (u32)off & ~(u32)(sizeof(window.bytes) - 1);
+		window.size = tinsel.read_window(Handle(window.index, window.start), window.bytes, sizeof(window.bytes));
+	}
+	return off - window.start < window.size ? window.bytes[off - window.start] : 0;
+}
+
+void delete_glimages()
+{
+	for (auto& glimage : glimages)
+	{
+		glDeleteTextures(1, &glimage.second.texture);
+		account_texture(glimage.first, -(i64)glimage.second.bytes);
+	}
+	glimages.clear();
+}
+
+size_t process_resident_bytes()
+{
+#ifdef __linux__
+	ifstream statm { "/proc/self/statm" };
+	size_t pages = 0;
+	size_t resident = 0;
+	statm >> pages >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
+
+// One line per schema field of a record.
+template<typename R>
+void render_fields(const R &record, u32 padding)
+{
+	for (const Field &field : Schema<R>::fields)
+	{
+		char value[128];
+		format_field(value, sizeof(value), record, field);
+		TextP(padding, "%s: %s", field.name, value);
+	}
+}
+
+// A column per schema field after the handle, returns the row clicked.
+template<typename R, typename V>
+const R* render_record_table(const char *id, const V &records, u32 flags)
+{
+	const R *clicked = nullptr;
+	if (BeginTable(id, 1 + field_count<R>(), flags | ImGuiTableFlags_ScrollX | ImGuiTableFlags_ScrollY, ImVec2(0.0f, 200.0f)))
+	{
+		TableSetupScrollFreeze(1, 1);
+		TableSetupColumn("handle");
+		for (const Field &field : Schema<R>::fields)
+		{
+			TableSetupColumn(field.name);
+		}
+		TableHeadersRow();
+
+		u32 i = 0;
+		for (auto &record : records)
+		{
+			PushID(i);
+			TableNextColumn();
+			char label[32] {};
+			sprintf(label, "%08x", record.handle);
+			if (Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns))
+			{
+				clicked = &record;
+			}
+			for (const Field &field : Schema<R>::fields)
+			{
+				char value[128];
+				format_field(value, sizeof(value), record, field);
+				TableNextColumn();
+				TextUnformatted(value);
+			}
+			++i;
+			PopID();
+		}
+		EndTable();
+	}
+	return clicked;
+}
 
 void render_image(::Image& image, u32 padding = 0)
 {
 	PushID(image.handle);
 	TextP(padding, "Image: %08x", image.handle);
-	TextP(padding+1, "width: %d", image.width);
-	TextP(padding+1, "height: %d", image.height);
-	TextP(padding+1, "aniOffX: %d", image.aniOffX);
-	TextP(padding+1, "aniOffY: %d", image.aniOffY);
-	TextP(padding+1, "hImgBits: %08x", image.hImgBits);
-	TextP(padding+1, "isRLE: %d", image.isRLE);
-	TextP(padding+1, "colorFlags: %08x", image.colorFlags);
+	render_fields(image, padding+1);
 
 	if (glimages.count(image.handle) == 0)
 	{
@@ -57,9 +169,11 @@ void render_image(::Image& image, u32 padding = 0)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); // Same
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0,  GL_RGBA, GL_UNSIGNED_BYTE, data.data());
 		glBindTexture(GL_TEXTURE_2D, 0);
-		glimages[image.handle] = texture;
+		u32 bytes = (u32)image.width * image.height * 4; // drivers pad RGB to 4 bytes
+		glimages[image.handle] = { texture, bytes };
+		account_texture(image.handle, bytes);
 	}
-	ImGui::Image((ImTextureID)(uintptr_t)glimages[image.handle], { (float)image.width, (float)image.height });
+	ImGui::Image((ImTextureID)(uintptr_t)glimages[image.handle].texture, { (float)image.width, (float)image.height });
 	PopID();
 }
 
@@ -77,13 +191,7 @@ void render_multi_init(MultiInit &mi, u32 padding = 0)
 {
 	PushID(mi.handle);
 	TextP(padding, "MultiInitObject: %08x", mi.handle);
-	TextP(padding+1, "hMulFrame: %08x", mi.hMulFrame);
-	TextP(padding+1, "mulFlags: %08x", mi.mulFlags);
-	TextP(padding+1, "mulID: %08x", mi.mulID);
-	TextP(padding+1, "mulX: %d", mi.mulX);
-	TextP(padding+1, "mulY: %d", mi.mulY);
-	TextP(padding+1, "mulZ: %d", mi.mulZ);
-	TextP(padding+1, "otherFlags: %08x", mi.otherFlags);
+	render_fields<MultiInitRecord>(mi, padding+1);
 	TextP(padding+1, "frames:");
 	render_frames(mi.frames, padding+1);
 	PopID();
@@ -136,26 +244,133 @@ void render_film(Film &film, u32 padding = 0)
 	PopID();
 }
 
+// Atlas textures by font handle, they live as long as the atlases.
+map<u32, GLuint> fontTextures;
+
+// Draws a laid out string at the cursor, one quad per glyph from the atlas.
+void render_text_layout(const GlyphAtlas &atlas, const TextLayout &layout)
+{
+	if (atlas.height == 0)
+	{
+		return;
+	}
+	if (fontTextures.count(layout.font) == 0)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas.width, atlas.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas.pixels.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+		fontTextures[layout.font] = texture;
+	}
+	ImTextureID texture = (ImTextureID)(uintptr_t)fontTextures[layout.font];
+
+	ImVec2 origin = GetCursorScreenPos();
+	ImDrawList *drawList = GetWindowDrawList();
+	for (auto& quad : layout.quads)
+	{
+		const Glyph &glyph = atlas.glyphs[quad.glyph];
+		ImVec2 p0 { origin.x + quad.x, origin.y + quad.y };
+		ImVec2 p1 { p0.x + glyph.width, p0.y + glyph.height };
+		ImVec2 uv0 { (float)glyph.x / atlas.width, (float)glyph.y / atlas.height };
+		ImVec2 uv1 { (float)(glyph.x + glyph.width) / atlas.width, (float)(glyph.y + glyph.height) / atlas.height };
+		drawList->AddImage(texture, p0, p1, uv0, uv1);
+	}
+	Dummy(ImVec2((float)layout.width, (float)layout.height));
+}
+
 void render_scene(Scene &scene, u32 padding = 0)
 {
 	TextP(padding, "Scene:");
-	TextP(padding+1, "defRefer: %d", scene.defRefer);
-	TextP(padding+1, "hSceneScript: %08x", scene.hSceneScript);
-	TextP(padding+1, "hSceneDesc: %08x", scene.hSceneDesc);
-	TextP(padding+1, "numEntrance: %d", scene.numEntrance);
-	TextP(padding+1, "hEntrance: %08x", scene.hEntrance);
-	TextP(padding+1, "numCameras: %d", scene.numCameras);
-	TextP(padding+1, "hCamera: %08x", scene.hCamera);
-	TextP(padding+1, "numLights: %d", scene.numLights);
-	TextP(padding+1, "hLight: %08x", scene.hLight);
-	TextP(padding+1, "numPoly: %d", scene.numPoly);
-	TextP(padding+1, "hPoly: %08x", scene.hPoly);
-	TextP(padding+1, "numTaggedActor: %d", scene.numTaggedActor);
-	TextP(padding+1, "hTaggedActor: %08x", scene.hTaggedActor);
-	TextP(padding+1, "numProcess: %d", scene.numProcess);
-	TextP(padding+1, "hProcess: %08x", scene.hProcess);
-	TextP(padding+1, "hMusicScript: %08x", scene.hMusicScript);
-	TextP(padding+1, "hMusicSegment: %08x", scene.hMusicSegment);
+	render_fields<SceneRecord>(scene, padding+1);
+}
+
+void render_decompression_stats(Tinsel &tinsel, u32 flags)
+{
+	static u32 selected = 0xFFFFFFFF;
+
+	if (Begin("Decompression stats"))
+	{
+		Checkbox("Record", &tinsel.collectStats);
+		SameLine();
+		if (Button("Save CSV"))
+		{
+			tinsel.save_stats_csv("decompression_stats.csv");
+		}
+
+		LzssStats total {};
+		if (BeginTable("stats", 8, flags | ImGuiTableFlags_ScrollY, ImVec2(0.0f, 300.0f)))
+		{
+			TableSetupColumn("Name");
+			TableSetupColumn("Input");
+			TableSetupColumn("Output");
+			TableSetupColumn("Ratio");
+			TableSetupColumn("ms");
+			TableSetupColumn("MB/s");
+			TableSetupColumn("Literals");
+			TableSetupColumn("Matches");
+			TableHeadersRow();
+
+			for (auto& memHandle : tinsel.memHandles)
+			{
+				const LzssStats &stats = memHandle.stats;
+				if (stats.outputBytes == 0)
+				{
+					continue;
+				}
+				total.add(stats);
+
+				PushID(memHandle.id);
+				TableNextColumn();
+				if (Selectable(string { memHandle.name }.c_str(), selected == memHandle.id, ImGuiSelectableFlags_SpanAllColumns))
+				{
+					selected = memHandle.id;
+				}
+				TableNextColumn();
+				Text("%10llu", (unsigned long long)stats.inputBytes);
+				TableNextColumn();
+				Text("%10llu", (unsigned long long)stats.outputBytes);
+				TableNextColumn();
+				Text("%.3f", (double)stats.inputBytes / stats.outputBytes);
+				TableNextColumn();
+				Text("%.2f", stats.seconds * 1000.0);
+				TableNextColumn();
+				Text("%.1f", stats.outputBytes / stats.seconds / 1e6);
+				TableNextColumn();
+				Text("%llu", (unsigned long long)stats.literals);
+				TableNextColumn();
+				Text("%llu", (unsigned long long)stats.matches);
+				PopID();
+			}
+			EndTable();
+		}
+
+		if (total.outputBytes != 0)
+		{
+			Text("Total: %llu -> %llu bytes, %.2f ms decode, %.2f ms read, %.1f MB/s",
+				(unsigned long long)total.inputBytes, (unsigned long long)total.outputBytes,
+				total.seconds * 1000.0, total.readSeconds * 1000.0, total.outputBytes / total.seconds / 1e6);
+		}
+
+		const LzssStats &stats = selected < tinsel.memHandles.size() ? tinsel.memHandles[selected].stats : total;
+		float lengths[16];
+		float distances[13];
+		for (u32 i = 0; i < 16; ++i)
+		{
+			lengths[i] = (float)stats.lengths[i];
+		}
+		for (u32 i = 0; i < 13; ++i)
+		{
+			distances[i] = (float)stats.distances[i];
+		}
+		PlotHistogram("match length 2-17", lengths, 16, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+		PlotHistogram("distance 2^0-2^12", distances, 13, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+	}
+	End();
 }
 
 void render_ui(Tinsel &tinsel)
@@ -164,7 +379,7 @@ void render_ui(Tinsel &tinsel)
 
 	static MemHandle* selected_memhandle = nullptr;
 	static PcodeScript *selected_script = nullptr;
-	static u32 selected_handle = 0;
+	static Handle selected_handle;
 	static u32 selected_film = 0;
 
 	u32 flags =
@@ -173,33 +388,117 @@ void render_ui(Tinsel &tinsel)
 
 	if (Begin("Handles"))
 	{
-		BeginChild("list", ImVec2(400, 0));
+		BeginChild("list", ImVec2(800, 0));
 
 		if (Button("Load all"))
 		{
 			for (auto& memHandle : tinsel.memHandles)
 			{
-				tinsel.load_memhandle(memHandle.id);
+				tinsel.load_memhandle_async(memHandle.id);
 			}
 		}
 		SameLine();
 		if (Button("Unload all"))
 		{
+			for (auto& memHandle : tinsel.memHandles)
+			{
+				tinsel.unload_memhandle(memHandle.id);
+			}
+			if (selected_memhandle != nullptr && !selected_memhandle->loaded)
+			{
+				selected_memhandle = nullptr;
+				selected_script = nullptr;
+			}
+		}
+
+		static int budgetMB = tinsel.memoryBudget / (1024 * 1024);
+		SetNextItemWidth(100.0f);
+		if (InputInt("Budget MB (0 = none)", &budgetMB))
+		{
+			budgetMB = max(budgetMB, 0);
+			tinsel.memoryBudget = (size_t)budgetMB * 1024 * 1024;
+		}
+		size_t handlesTotal = 0;
+		for (auto& memHandle : tinsel.memHandles)
+		{
+			handlesTotal += tinsel.memory_usage(memHandle.id).total();
 		}
+		Text("Resident: %.1f MB data and parsed, %.1f MB all handles, %.1f MB process",
+			tinsel.resident_bytes() / (1024.0 * 1024.0),
+			handlesTotal / (1024.0 * 1024.0),
+			process_resident_bytes() / (1024.0 * 1024.0));
 
-		if (BeginTable("handles", 6, flags))
+		if (tinsel.loadsQueued != 0)
 		{
-			TableSetupColumn("ID");
+			char progress[32] {};
+			sprintf(progress, "%d/%d", tinsel.loadsDone, tinsel.loadsQueued);
+			ProgressBar((float)tinsel.loadsDone / tinsel.loadsQueued, ImVec2(-1.0f, 0.0f), progress);
+		}
+
+		if (BeginTable("handles", 14, flags | ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY))
+		{
+			TableSetupColumn("ID", ImGuiTableColumnFlags_DefaultSort);
 			TableSetupColumn("Name");
 			TableSetupColumn("Size");
 			TableSetupColumn("Flags");
 			TableSetupColumn("Loaded");
-			TableSetupColumn("Action");
+			TableSetupColumn("Data KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Chunks KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Scripts KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Scene KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Objects KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Slack KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Textures KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Total KB", ImGuiTableColumnFlags_PreferSortDescending);
+			TableSetupColumn("Action", ImGuiTableColumnFlags_NoSort);
 			TableHeadersRow();
 
-			u32 i = 0;
-			for (auto &handle : tinsel.memHandles)
+			// Sizes change as handles load, so the order is rebuilt every frame.
+			vector<u32> order(tinsel.memHandles.size());
+			vector<MemoryUsage> usage(tinsel.memHandles.size());
+			for (u32 i = 0; i < order.size(); ++i)
+			{
+				order[i] = i;
+				usage[i] = tinsel.memory_usage(i);
+			}
+			ImGuiTableSortSpecs *sortSpecs = TableGetSortSpecs();
+			if (sortSpecs != nullptr && sortSpecs->SpecsCount > 0)
 			{
+				const ImGuiTableColumnSortSpecs &spec = sortSpecs->Specs[0];
+				auto key = [&](u32 i) -> size_t {
+					const MemoryUsage &u = usage[i];
+					switch (spec.ColumnIndex)
+					{
+						case 2: return tinsel.memHandles[i].size;
+						case 3: return tinsel.memHandles[i].flags;
+						case 4: return tinsel.memHandles[i].loaded;
+						case 5: return u.data;
+						case 6: return u.chunks;
+						case 7: return u.scripts;
+						case 8: return u.scene;
+						case 9: return u.objects;
+						case 10: return u.slack;
+						case 11: return u.textures;
+						case 12: return u.total();
+						default: return i;
+					}
+				};
+				auto less = [&](u32 a, u32 b) {
+					if (spec.ColumnIndex == 1)
+					{
+						return tinsel.memHandles[a].name < tinsel.memHandles[b].name;
+					}
+					return key(a) < key(b);
+				};
+				stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+					return spec.SortDirection == ImGuiSortDirection_Descending ? less(b, a) : less(a, b);
+				});
+				sortSpecs->SpecsDirty = false;
+			}
+
+			for (u32 i : order)
+			{
+				auto &handle = tinsel.memHandles[i];
 				PushID(i);
 				TableNextColumn();
 				char label[32] {};
@@ -209,14 +508,11 @@ void render_ui(Tinsel &tinsel)
 				if (Selectable(label, selected, ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowItemOverlap))
 				{
 					selected_memhandle = &handle;
-					if (handle.loaded)
-					{
-						selected_handle = (i << 25);
-						selected_script = nullptr;
-					}
+					selected_handle = Handle(i, 0);
+					selected_script = nullptr;
 				}
 				TableNextColumn();
-				TextUnformatted(handle.name.c_str());
+				TextUnformatted(handle.name.data(), handle.name.data() + handle.name.size());
 				TableNextColumn();
 				Text("%10d", handle.size);
 				TableNextColumn();
@@ -226,6 +522,16 @@ void render_ui(Tinsel &tinsel)
 				{
 					Text("x");
 				}
+				else if (handle.loading)
+				{
+					Text("...");
+				}
+				const MemoryUsage &u = usage[i];
+				for (size_t bytes : { u.data, u.chunks, u.scripts, u.scene, u.objects, u.slack, u.textures, u.total() })
+				{
+					TableNextColumn();
+					Text("%8.1f", bytes / 1024.0);
+				}
 				TableNextColumn();
 				if (handle.loaded)
 				{
@@ -236,18 +542,19 @@ void render_ui(Tinsel &tinsel)
 							if (selected_memhandle == &handle)
 							{
 								selected_memhandle = nullptr;
+								selected_script = nullptr;
 							}
+							tinsel.unload_memhandle(i);
 						}
 					}
 				}
-				else
+				else if (!handle.loading)
 				{
 					if (SmallButton("Load"))
 					{
 						tinsel.load_memhandle(i);
 					}
 				}
-				++i;
 				PopID();
 			}
 			EndTable();
@@ -280,7 +587,7 @@ void render_ui(Tinsel &tinsel)
 							sprintf(label, "%08x", chunk.pos);
 							if (Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns))
 							{
-								selected_handle = (selected_memhandle->id << 25) | chunk.pos;
+								selected_handle = Handle(selected_memhandle->id, chunk.pos);
 							}
 							TableNextColumn();
 							Text("%10d", chunk.size);
@@ -294,90 +601,53 @@ void render_ui(Tinsel &tinsel)
 						EndTable();
 					}
 
+					if (selected_memhandle->hasScene || selected_memhandle->hasObjects)
+					{
+						string name { selected_memhandle->name };
+						if (Button("Export CSV"))
+						{
+							tinsel.save_records_csv(selected_memhandle->id, name);
+						}
+						SameLine();
+						if (Button("Export JSON"))
+						{
+							tinsel.save_records_json(selected_memhandle->id, name + ".json");
+						}
+					}
+
 					if (selected_memhandle->hasScene)
 					{
 						render_scene(selected_memhandle->scene);
 
 						Text("Entrances:");
-						if (BeginTable("entrances", 5, flags))
+						if (auto entrance = render_record_table<Entrance>("entrances", selected_memhandle->scene.entrances, flags))
 						{
-							TableSetupColumn("handle");
-							TableSetupColumn("eNumber");
-							TableSetupColumn("hScript");
-							TableSetupColumn("hEntDesc");
-							TableSetupColumn("flags");
-							TableHeadersRow();
-
-							u32 i = 0;
-							for (auto &ent : selected_memhandle->scene.entrances)
-							{
-								PushID(i);
-								TableNextColumn();
-								char label[32] {};
-								sprintf(label, "%08x", ent.handle);
-								if (Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns))
-								{
-									selected_handle = ent.handle;
-								}
-								TableNextColumn();
-								Text("%d", ent.eNumber);
-								TableNextColumn();
-								Text("%08x", ent.hScript);
-								TableNextColumn();
-								Text("%08x", ent.hEntDesc);
-								TableNextColumn();
-								Text("%08x", ent.flags);
-								++i;
-								PopID();
-							}
+							selected_handle = entrance->handle;
+						}
 
-							EndTable();
+						Text("Polygons:");
+						if (auto poly = render_record_table<Poly>("polys", selected_memhandle->scene.polys, flags))
+						{
+							selected_handle = poly->handle;
+						}
+
+						Text("Actors:");
+						if (auto actor = render_record_table<Actor>("actors", selected_memhandle->scene.actors, flags))
+						{
+							selected_handle = actor->handle;
 						}
 					}
 
 					if (selected_memhandle->hasObjects)
 					{
 						Text("Objects:");
-						if (BeginTable("objects", 6, flags))
+						if (auto obj = render_record_table<Object>("objects", selected_memhandle->objects, flags))
 						{
-							TableSetupColumn("id");
-							TableSetupColumn("hIconFilm");
-							TableSetupColumn("hScript");
-							TableSetupColumn("attribute");
-							TableSetupColumn("title");
-							TableSetupColumn("notClue");
-							TableHeadersRow();
-
-							u32 i = 0;
-							for (auto &obj : selected_memhandle->objects)
+							selected_handle = obj->handle;
+							if (obj->hIconFilm > 0x160)  // meh
 							{
-								PushID(i);
-								TableNextColumn();
-								char label[32] {};
-								sprintf(label, "%x", obj.id);
-								if (Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns))
-								{
-									selected_handle = obj.handle;
-									if (obj.hIconFilm > 0x160)  // meh
-									{
-										selected_film = obj.hIconFilm;
-									}
-								}
-								TableNextColumn();
-								Text("%08x", obj.hIconFilm);
-								TableNextColumn();
-								Text("%08x", obj.hScript);
-								TableNextColumn();
-								Text("%08x", obj.attribute);
-								TableNextColumn();
-								Text("%8x", obj._u);
-								TableNextColumn();
-								Text("%8x", obj.notClue);
-								++i;
-								PopID();
+								selected_film = obj->hIconFilm;
 							}
-
-							EndTable();
 						}
 					}
 				}
@@ -405,6 +675,7 @@ void render_ui(Tinsel &tinsel)
 						{
 							selected_script = &script;
 							selected_handle = script.handle;
+							tinsel.disassemble_script(selected_memhandle->id, script);
 						}
 						TableNextColumn();
 						TextUnformatted(script.name.c_str());
@@ -459,11 +730,7 @@ void render_ui(Tinsel &tinsel)
 
 		if (loaded_film != selected_film)
 		{
-			for(auto glimage : glimages)
-			{
-				glDeleteTextures(1, (GLuint*)&glimage.second);
-			}
-			glimages.clear();
+			delete_glimages();
 			cached_film = tinsel.parse_film(selected_film);
 			loaded_film = selected_film;
 		}
@@ -475,6 +742,177 @@ void render_ui(Tinsel &tinsel)
 		End();
 	}
 
+	render_decompression_stats(tinsel, flags);
+
+	if (Begin("Chunk catalog"))
+	{
+		if (!tinsel.chunkCatalog)
+		{
+			if (Button("Catalog loaded chunks"))
+			{
+				tinsel.enable_chunk_catalog();
+			}
+		}
+		else
+		{
+			static ChunkType catalogType = ChunkType::CHUNK_SCENE;
+			if (BeginCombo("type", tinsel.chunkTypeNames[catalogType].c_str()))
+			{
+				for (auto& [type, name] : tinsel.chunkTypeNames)
+				{
+					if (Selectable(name.c_str(), type == catalogType))
+					{
+						catalogType = type;
+					}
+				}
+				EndCombo();
+			}
+
+			vector<Handle> found = tinsel.find_chunks(catalogType);
+			Text("%d chunks", (u32)found.size());
+			if (BeginTable("catalog", 3, flags | ImGuiTableFlags_ScrollY, ImVec2(0.0f, 300.0f)))
+			{
+				TableSetupColumn("Handle");
+				TableSetupColumn("MemHandle");
+				TableSetupColumn("Name");
+				TableHeadersRow();
+
+				for (Handle h : found)
+				{
+					PushID(h.value);
+					TableNextColumn();
+					char label[32] {};
+					sprintf(label, "%08x", h.value);
+					if (Selectable(label, selected_handle == h, ImGuiSelectableFlags_SpanAllColumns))
+					{
+						selected_handle = h;
+						selected_memhandle = &tinsel.memHandles[h.index()];
+						selected_script = nullptr;
+					}
+					TableNextColumn();
+					Text("%d", h.index());
+					TableNextColumn();
+					TextUnformatted(string { tinsel.memHandles[h.index()].name }.c_str());
+					PopID();
+				}
+				EndTable();
+			}
+		}
+	}
+	End();
+
+	if (Begin("Scene graph"))
+	{
+		const SceneGraph &graph = tinsel.sceneGraph;
+
+		// Selects a scene and starts loading it, its references are then
+		// prefetched below once it is in.
+		auto jump = [&](u32 id)
+		{
+			tinsel.load_memhandle_async(id);
+			selected_memhandle = &tinsel.memHandles[id];
+			selected_script = nullptr;
+		};
+		auto node_name = [&](u32 node)
+		{
+			return string { tinsel.memHandles[graph.nodes[node].memHandle].name };
+		};
+
+		if (Button("Build"))
+		{
+			tinsel.build_scene_graph();
+		}
+		SameLine();
+		Text("%d scenes, %d links", (u32)graph.nodes.size(), (u32)graph.edges.size());
+
+		u32 current = selected_memhandle != nullptr ? graph.find(Handle(selected_memhandle->id, 0)) : SceneGraph::kNone;
+		if (current != SceneGraph::kNone)
+		{
+			Text("Links from %s, %d scenes reachable:", node_name(current).c_str(), (u32)graph.reachable(current).size() - 1);
+			for (u32 e = graph.edgeStart[current]; e < graph.edgeStart[current + 1]; ++e)
+			{
+				const SceneGraph::Edge &edge = graph.edges[e];
+				PushID(e);
+				if (SmallButton("Go"))
+				{
+					jump(graph.nodes[edge.to].memHandle);
+				}
+				SameLine();
+				const HopperEntry *entrance = graph.find_entrance(edge.to, edge.entrance);
+				if (entrance != nullptr && entrance->hDesc != 0 && tinsel.stringsId != 0xFFFFFFFF)
+				{
+					Text("%s entrance %d: %s", node_name(edge.to).c_str(), edge.entrance, tinsel.get_string(entrance->hDesc).c_str());
+				}
+				else
+				{
+					Text("%s entrance %d", node_name(edge.to).c_str(), edge.entrance);
+				}
+				PopID();
+			}
+
+			static char routeTo[64];
+			SetNextItemWidth(200.0f);
+			InputText("route to", routeTo, sizeof(routeTo));
+			u32 target = graph.find(routeTo);
+			if (target != SceneGraph::kNone)
+			{
+				vector<u32> route = graph.path(current, target);
+				if (route.empty())
+				{
+					Text("not reachable");
+				}
+				for (u32 node : route)
+				{
+					if (Selectable(node_name(node).c_str(), false))
+					{
+						jump(graph.nodes[node].memHandle);
+					}
+				}
+			}
+		}
+		else if (!graph.nodes.empty())
+		{
+			Text("Select a scene in Handles to see its links.");
+		}
+	}
+	End();
+
+	// Warm the handles the selected scene refers to once it is loaded.
+	static MemHandle *prefetched = nullptr;
+	if (selected_memhandle == nullptr || !selected_memhandle->loaded)
+	{
+		prefetched = nullptr;
+	}
+	else if (selected_memhandle != prefetched)
+	{
+		tinsel.prefetch_referenced(selected_memhandle->id);
+		prefetched = selected_memhandle;
+	}
+
+	// Keep whatever the windows above show resident for trim_memory.
+	static vector<u32> pinned;
+	for (u32 id : pinned)
+	{
+		tinsel.memHandles[id].pinned = false;
+	}
+	pinned.clear();
+	if (selected_memhandle != nullptr)
+	{
+		pinned.push_back(selected_memhandle->id);
+	}
+	if (tinsel.is_valid(selected_handle))
+	{
+		pinned.push_back(selected_handle.index());
+	}
+	if (tinsel.is_valid(selected_film))
+	{
+		pinned.push_back(Handle(selected_film).index());
+	}
+	for (u32 id : pinned)
+	{
+		tinsel.memHandles[id].pinned = true;
+	}
+
 	if (Begin("Text decoder"))
 	{
 		static char textIdStr[1024];
@@ -489,34 +927,186 @@ void render_ui(Tinsel &tinsel)
 		{
 			TextUnformatted(tinsel.get_string(textId).c_str());
 		}
+
+		static vector<u32> fonts;
+		static u32 font = 0;
+		if (Button("Find fonts"))
+		{
+			fonts = tinsel.find_fonts();
+			if (find(fonts.begin(), fonts.end(), font) == fonts.end())
+			{
+				font = fonts.empty() ? 0 : fonts[0];
+			}
+		}
+		SameLine();
+		char fontLabel[32] = "none";
+		if (font != 0)
+		{
+			sprintf(fontLabel, "%08x", font);
+		}
+		SetNextItemWidth(120.0f);
+		if (BeginCombo("font", fontLabel))
+		{
+			for (u32 f : fonts)
+			{
+				char label[32];
+				sprintf(label, "%08x", f);
+				if (Selectable(label, f == font))
+				{
+					font = f;
+				}
+			}
+			EndCombo();
+		}
+
+		static const u32 kPreviewWidth = 600;
+		if (font != 0)
+		{
+			const GlyphAtlas &atlas = tinsel.font_atlas(font);
+			static TextLayout decoded;
+			static u32 decodedId = 0;
+			if (textId != 0 && (decodedId != textId || decoded.font != font))
+			{
+				decoded = tinsel.layout_text(atlas, tinsel.get_string(textId), kPreviewWidth);
+				decodedId = textId;
+			}
+			if (textId != 0)
+			{
+				render_text_layout(atlas, decoded);
+			}
+
+			// A run of consecutive strings, laid out once when asked for.
+			static int firstId = 0;
+			static int count = 32;
+			static vector<u32> previewIds;
+			static vector<TextLayout> preview;
+			SetNextItemWidth(120.0f);
+			InputInt("first", &firstId);
+			SameLine();
+			SetNextItemWidth(120.0f);
+			InputInt("count", &count);
+			SameLine();
+			if (Button("Preview"))
+			{
+				previewIds.clear();
+				for (int id = max(firstId, 0); id < max(firstId, 0) + count; ++id)
+				{
+					previewIds.push_back(id);
+				}
+				preview = tinsel.layout_strings(font, previewIds, kPreviewWidth);
+			}
+			if (!preview.empty() && preview[0].font == font)
+			{
+				if (BeginChild("preview"))
+				{
+					for (size_t k = 0; k < preview.size(); ++k)
+					{
+						Text("%x", previewIds[k]);
+						render_text_layout(atlas, preview[k]);
+					}
+				}
+				EndChild();
+			}
+		}
 		End();
 	}
 
-	if (selected_handle != 0)
+	if (selected_handle)
 	{
 		MemHandle* memHandle = tinsel.get_memhandle(selected_handle);
-		if (memHandle && memHandle->loaded)
+		if (memHandle)
 		{
-			static u32 current_handle = 0;
+			static Handle current_handle;
 			static MemoryEditor mem_edit;
+			static MemoryWindow window;
 			mem_edit.HighlightColor = 0xff0000ff;
 			if (selected_handle != current_handle)
 			{
-				u32 offset = tinsel.get_offset(selected_handle);
+				u32 offset = selected_handle.offset();
 				mem_edit.GotoAddrAndHighlight(offset, offset + 1);
 				current_handle = selected_handle;
+				window.index = selected_handle.index();
+				window.size = 0;
 			}
 			mem_edit.ReadOnly = true;
-			mem_edit.DrawWindow("Memory Editor", memHandle->data.data(), memHandle->size);
+			if (memHandle->loaded)
+			{
+				mem_edit.ReadFn = nullptr;
+				mem_edit.DrawWindow("Memory Editor", (void*)memHandle->data, memHandle->size);
+			}
+			else
+			{
+				mem_edit.ReadFn = read_memory_window;
+				mem_edit.DrawWindow("Memory Editor", &window, memHandle->size);
+			}
 		}
 	}
 }
 
 int main(int argc, char* argv[])
 {
+	if (argc > 1 && string { argv[1] } == "--test-lzss")
+	{
+		bool passed = test_lzss_decoders(2000, 1);
+		passed = test_lzss_encoder(200, 1) && passed;
+		return passed ? 0 : 1;
+	}
+
+	// --budget <MB> limits resident decompressed data
+	// --trace records accesses and updates preload.plan on exit
+	// --shared-cache shares decompressed handles with other processes
+	// --clear-shared-cache removes what earlier processes shared
+	bool trace = false;
+	for (int a = 1; a < argc; ++a)
+	{
+		string arg { argv[a] };
+		if (arg == "--budget" && a + 1 < argc)
+		{
+			tinsel.memoryBudget = (size_t)atoi(argv[++a]) * 1024 * 1024;
+		}
+		else if (arg == "--trace")
+		{
+			trace = true;
+		}
+		else if (arg == "--shared-cache")
+		{
+			tinsel.sharedCache = true;
+		}
+		else if (arg == "--clear-shared-cache")
+		{
+			tinsel.clear_shared_cache();
+		}
+	}
+	if (trace)
+	{
+		tinsel.start_trace();
+	}
+
 	tinsel.load_index();
 	tinsel.load_strings();
 
+	if (argc > 1 && string { argv[1] } == "--bench-lzss")
+	{
+		tinsel.benchmark_lzss();
+		return 0;
+	}
+
+	// --repack <name> <output> [effort]
+	if (argc > 3 && string { argv[1] } == "--repack")
+	{
+		for (auto& memHandle : tinsel.memHandles)
+		{
+			if (memHandle.name == argv[2])
+			{
+				u32 effort = argc > 4 ? atoi(argv[4]) : 6;
+				return tinsel.repack_memhandle(memHandle.id, argv[3], effort) ? 0 : 1;
+			}
+		}
+		return 1;
+	}
+
+
+	tinsel.load_preload_plan("preload.plan");
 
 	// SDL setup
 	SDL_Init(SDL_INIT_VIDEO);
@@ -597,6 +1187,8 @@ int main(int argc, char* argv[])
 		ImGui_ImplSDL2_NewFrame(window);
 		ImGui::NewFrame();
 
+		tinsel.publish_loaded(0.010);
+		tinsel.trim_memory();
 		render_ui(tinsel);
 
 		ImGui::Render();
@@ -605,6 +1197,12 @@ int main(int argc, char* argv[])
 		SDL_GL_SwapWindow(window);
 		frame++;
 	}
+
+	if (trace)
+	{
+		tinsel.save_trace_csv("access_trace.csv");
+		tinsel.save_preload_plan("preload.plan");
+	}
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+#include "base.hpp"
+
+using namespace std;
+
+// Fixed set of threads running queued tasks in submission order. Tasks
+// submitted as background only run while no normal task is waiting.
+struct WorkerPool
+{
+	WorkerPool(u32 count = thread::hardware_concurrency())
+	{
+		if (count == 0)
+		{
+			count = 1;
+		}
+		for (u32 i = 0; i < count; ++i)
+		{
+			threads.emplace_back([this] { run(); });
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock { queueMutex };
+			stopping = true;
+		}
+		queueReady.notify_all();
+		for (auto& t : threads)
+		{
+			t.join();
+		}
+	}
+
+	void submit(function<void()> task, bool background = false)
+	{
+		{
+			lock_guard<mutex> lock { queueMutex };
+			(background ? backgroundQueue : queue).push_back(std::move(task));
+		}
+		queueReady.notify_one();
+	}
+
+	u32 size() const
+	{
+		return threads.size();
+	}
+
+private:
+	void run()
+	{
+		while (true)
+		{
+			function<void()> task;
+			{
+				unique_lock<mutex> lock { queueMutex };
+				queueReady.wait(lock, [this] { return stopping || !queue.empty() || !backgroundQueue.empty(); });
+				deque<function<void()>> &next = queue.empty() ? backgroundQueue : queue;
+				if (next.empty())
+				{
+					return;
+				}
+				task = std::move(next.front());
+				next.pop_front();
+			}
+			task();
+		}
+	}
+
+	vector<thread> threads;
+	deque<function<void()>> queue;
+	deque<function<void()>> backgroundQueue;
+	mutex queueMutex;
+	condition_variable queueReady;
+	bool stopping = false;
+};